@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "scene.h"
+#include "thread_pool.h"
+#include "sys_perf.h"
+
+/*
+ * Headless particle simulation benchmark. Runs the systems of particle on a
+ * scene populated with particles and pins from a fixed seed and prints the
+ * wall clock time of each system and of the whole tick as CSV. The systems
+ * are ticked through sys_sched, which times them.
+ *
+ * Given a comma separated list of sys_perf_field names the systems are
+ * ticked through decs_tick() instead and the per system cost is taken from
+ * the decs perf stats, which can also be written out for every tick to a CSV
+ * file. The counters read zero where perf events aren't available and only
+ * count the thread a system was run on.
+ *
+ * Usage: bench [particles] [pins] [ticks] [threads] [counters] [tick CSV]
+ */
+
+#define BENCH_ASPECT (16.0f / 9.0f)
+
+static float randf(float min, float max)
+{
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct vec3 rand_pos(void)
+{
+    return (struct vec3) {
+        randf(-BENCH_ASPECT, BENCH_ASPECT),
+        randf(-1.0f, 1.0f),
+        0.0f
+    };
+}
+
+int main(int argc, char **argv)
+{
+    size_t n_particles = 100000;
+    size_t n_pins = 16;
+    unsigned n_ticks = 600;
+    unsigned n_threads = 1;
+    struct thread_pool thread_pool;
+    unsigned fields = 0;
+    const char *csv_path = NULL;
+    struct scene scene;
+    struct sys_perf sys_perf;
+    struct perf_stats *start_stats = NULL;
+    size_t n_ticked;
+    double start_ns, tick_ns;
+    double n_entities = 0;
+    double val;
+    unsigned tick;
+    size_t i;
+    unsigned j;
+    int ret = EXIT_SUCCESS;
+
+    if (argc > 1)
+        n_particles = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        n_pins = strtoul(argv[2], NULL, 0);
+    if (argc > 3)
+        n_ticks = strtoul(argv[3], NULL, 0);
+    if (argc > 4)
+        n_threads = strtoul(argv[4], NULL, 0);
+    if (argc > 5 && sys_perf_parse_fields(argv[5], &fields))
+        return EXIT_FAILURE;
+    if (argc > 6)
+        csv_path = argv[6];
+
+    if (!n_ticks) {
+        fprintf(stderr, "Tick count has to be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (thread_pool_init(&thread_pool, n_threads)) {
+        fprintf(stderr, "Thread pool init failed\n");
+        return EXIT_FAILURE;
+    }
+    phys_set_thread_pool(&thread_pool);
+
+    if (scene_init(&scene, BENCH_ASPECT)) {
+        ret = EXIT_FAILURE;
+        goto out_thread_pool_cleanup;
+    }
+    scene_set_parallel(&scene, !fields);
+
+    srand(1);
+    for (i = 0; i < n_pins; ++i)
+        scene_create_pin(&scene, rand_pos());
+    for (i = 0; i < n_particles; ++i)
+        scene_create_particle(&scene, rand_pos());
+
+    /* Warm up, the first tick pays for growing the broadphase storage */
+    scene_tick(&scene);
+
+    if (sys_perf_init(&sys_perf, &scene.decs, fields)) {
+        ret = EXIT_FAILURE;
+        goto out_scene_cleanup;
+    }
+    if (csv_path && sys_perf_open_csv(&sys_perf, csv_path)) {
+        ret = EXIT_FAILURE;
+        goto out_sys_perf_cleanup;
+    }
+
+    start_stats = malloc(sizeof(*start_stats) * sys_perf.n_systems);
+    if (!start_stats) {
+        ret = EXIT_FAILURE;
+        goto out_sys_perf_cleanup;
+    }
+
+    /* The perf stats are cumulative, the deltas are taken over the run */
+    for (i = 0; i < sys_perf.n_systems; ++i)
+        start_stats[i] = scene.decs.systems[i].perf_stats;
+
+    for (i = 0; i < scene.sys_sched.n_systems; ++i)
+        scene.sys_sched.systems[i].total_ns = 0;
+
+    start_ns = now_ns();
+    for (tick = 0; tick < n_ticks; ++tick) {
+        n_ticked = scene.entity_pool.n_live;
+        n_entities += n_ticked;
+        scene_tick(&scene);
+        sys_perf_sample(&sys_perf, &scene.decs, n_ticked);
+    }
+    tick_ns = (now_ns() - start_ns) / n_ticks;
+    n_entities /= n_ticks;
+
+    printf("name,unit,per_tick,per_entity\n");
+    for (i = 0; i < scene.sys_sched.n_systems && !fields; ++i) {
+        val = scene.sys_sched.systems[i].total_ns / (double)n_ticks;
+        printf("%s,ns,%.0f,%.2f\n", scene.sys_sched.systems[i].reg->name,
+               val, n_entities ? val / n_entities : 0.0);
+    }
+    for (i = 0; i < sys_perf.n_systems; ++i) {
+        for (j = 0; j < SYS_PERF_N_FIELDS; ++j) {
+            if (!(fields & (1u << j)))
+                continue;
+            val = (sys_perf_field_value(&scene.decs.systems[i].perf_stats, j) -
+                   sys_perf_field_value(start_stats + i, j)) /
+                  (double)n_ticks;
+            printf("%s,%s,%.0f,%.2f\n", scene.decs.systems[i].name,
+                   sys_perf_field_name(j), val,
+                   n_entities ? val / n_entities : 0.0);
+        }
+    }
+    printf("tick,ns,%.0f,%.2f\n", tick_ns,
+           n_entities ? tick_ns / n_entities : 0.0);
+
+    free(start_stats);
+
+out_sys_perf_cleanup:
+    sys_perf_cleanup(&sys_perf);
+
+out_scene_cleanup:
+    scene_cleanup(&scene);
+
+out_thread_pool_cleanup:
+    phys_set_thread_pool(NULL);
+    thread_pool_cleanup(&thread_pool);
+
+    return ret;
+}
@@ -0,0 +1,296 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decs.h"
+#include "vec3.h"
+#include "phys.h"
+#include "phys_sphere_col.h"
+
+/*
+ * Collision broadphase benchmark. For each backend and entity count a fresh
+ * world is populated with randomly placed particles and pins from a fixed
+ * seed, and the time of the physics tick is averaged over a number of ticks.
+ * Each run is repeated with the phys thread pool at 1, 2, 4, ... threads up
+ * to the given count, zero being one per online CPU. The narrowphase is also
+ * timed on its own, by the wall clock around phys_sphere_col as it runs on
+ * all of the threads, along with its speedup over the single threaded run.
+ *
+ * Usage: col_bench [ticks] [pin ratio] [threads] [entity count...]
+ */
+
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+struct comp_ids {
+    uint64_t phys_pos;
+    uint64_t phys_dyn;
+    uint64_t phys_sphere_col;
+};
+
+static const struct {
+    const char *name;
+    enum phys_col_broadphase broadphase;
+} backends[] = {
+    { "brute",  PHYS_COL_BROADPHASE_BRUTE },
+    { "grid",   PHYS_COL_BROADPHASE_GRID },
+    { "sap",    PHYS_COL_BROADPHASE_SAP },
+    { "bvh",    PHYS_COL_BROADPHASE_BVH },
+};
+
+static const size_t default_counts[] = { 1000, 4000, 16000, 64000 };
+
+static float randf(float min, float max)
+{
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+typedef void (*col_batch_func)(struct decs *, uint64_t, uint64_t, void *);
+
+/* Wall clock time spent in phys_sphere_col since the start of the run */
+static double col_ns;
+
+static void col_timed_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                           void *func_data)
+{
+    double start = now_ns();
+
+    ((col_batch_func)phys_sphere_col_batch_sys.func)(decs, eid, n, func_data);
+    col_ns += now_ns() - start;
+}
+
+/* phys_sphere_col_batch_sys with its ticks timed, set up by run() */
+static struct system_reg col_timed_sys;
+
+static void create_particle(struct decs *decs, const struct comp_ids *ids)
+{
+    struct phys_pos_comp *pos;
+    struct phys_dyn_comp *dyn;
+    struct phys_sphere_comp *sph;
+    uint64_t eid;
+
+    eid = decs_alloc_entity(decs, (UINT64_C(1) << ids->phys_pos) |
+                                  (UINT64_C(1) << ids->phys_dyn) |
+                                  (UINT64_C(1) << ids->phys_sphere_col));
+
+    pos = decs_get_comp(decs, ids->phys_pos, eid);
+    dyn = decs_get_comp(decs, ids->phys_dyn, eid);
+    sph = decs_get_comp(decs, ids->phys_sphere_col, eid);
+
+    pos->pos = (struct vec3) { randf(-1.7f, 1.7f), randf(-1.0f, 1.0f), 0.0f };
+    *dyn = (struct phys_dyn_comp) {
+        .vel = { randf(-0.5f, 0.5f), randf(-0.5f, 0.5f), 0.0f },
+        .mass = 7.0f,
+    };
+    *sph = (struct phys_sphere_comp) { .r = randf(0.005f, 0.015f) };
+}
+
+static void create_pin(struct decs *decs, const struct comp_ids *ids)
+{
+    struct phys_pos_comp *pos;
+    struct phys_sphere_comp *sph;
+    uint64_t eid;
+
+    eid = decs_alloc_entity(decs, (UINT64_C(1) << ids->phys_pos) |
+                                  (UINT64_C(1) << ids->phys_sphere_col));
+
+    pos = decs_get_comp(decs, ids->phys_pos, eid);
+    sph = decs_get_comp(decs, ids->phys_sphere_col, eid);
+
+    pos->pos = (struct vec3) { randf(-1.7f, 1.7f), randf(-1.0f, 1.0f), 0.0f };
+    *sph = (struct phys_sphere_comp) { .r = randf(0.005f, 0.05f) };
+}
+
+static int run(enum phys_col_broadphase broadphase, size_t n_entities,
+               float pin_ratio, unsigned n_ticks, double *ns_per_tick,
+               double *col_ns_per_tick)
+{
+    struct decs decs;
+    struct comp_ids ids;
+    struct phys_col_world world;
+    size_t n_pins = n_entities * pin_ratio;
+    double start;
+    unsigned tick;
+    size_t i;
+    int err = 0;
+
+    const struct {
+        const struct system_reg *sys_reg;
+        void *aux_ctx;
+    } systems[] = {
+        { &phys_gravity_batch_sys, NULL },
+        { &phys_drag_batch_sys, NULL },
+        { &phys_integrate_batch_sys, NULL },
+        { &phys_wall_col_batch_sys, NULL },
+        { &phys_post_col_batch_sys, NULL },
+        { &phys_sphere_col_build_batch_sys, &world },
+        { &col_timed_sys, &world },
+    };
+
+    col_timed_sys = phys_sphere_col_batch_sys;
+    col_timed_sys.func = col_timed_tick;
+
+    decs_init(&decs);
+    phys_col_world_init(&world);
+    world.broadphase = broadphase;
+
+    ids.phys_pos = decs_register_comp(&decs, "phys_pos",
+                                      sizeof(struct phys_pos_comp));
+    ids.phys_dyn = decs_register_comp(&decs, "phys_dyn",
+                                      sizeof(struct phys_dyn_comp));
+    ids.phys_sphere_col = decs_register_comp(&decs, "phys_sphere_col",
+                                             sizeof(struct phys_sphere_comp));
+
+    for (i = 0; i < ARRAY_SIZE(systems); ++i) {
+        err = decs_register_system(&decs, systems[i].sys_reg,
+                                   systems[i].aux_ctx, NULL);
+        if (err < 0) {
+            fprintf(stderr, "Error occurred while registering system \"%s\"\n",
+                    systems[i].sys_reg->name);
+            goto out;
+        }
+    }
+
+    decs_tick_dryrun(&decs);
+
+    srand(1);
+    for (i = 0; i < n_pins; ++i)
+        create_pin(&decs, &ids);
+    for (i = n_pins; i < n_entities; ++i)
+        create_particle(&decs, &ids);
+
+    /*
+     * Warm up, the first tick collects the pins and builds the broadphase,
+     * which are then kept for the measured ticks
+     */
+    decs_tick(&decs);
+    phys_col_world_tick(&world);
+
+    col_ns = 0.0;
+    start = now_ns();
+    for (tick = 0; tick < n_ticks; ++tick) {
+        decs_tick(&decs);
+        phys_col_world_tick(&world);
+    }
+    *ns_per_tick = (now_ns() - start) / n_ticks;
+    *col_ns_per_tick = col_ns / n_ticks;
+
+out:
+    phys_col_world_cleanup(&world);
+    decs_cleanup(&decs);
+
+    return err;
+}
+
+/* Doubles n_threads, stopping at max_threads on the way past it */
+static unsigned next_thread_count(unsigned n_threads, unsigned max_threads)
+{
+    if (n_threads < max_threads && n_threads * 2 > max_threads)
+        return max_threads;
+
+    return n_threads * 2;
+}
+
+/* Runs with the phys thread pool at n_threads threads */
+static int run_threads(enum phys_col_broadphase broadphase, size_t n_entities,
+                       float pin_ratio, unsigned n_ticks, unsigned n_threads,
+                       double *ns_per_tick, double *col_ns_per_tick)
+{
+    struct thread_pool thread_pool;
+    int err;
+
+    if (thread_pool_init(&thread_pool, n_threads)) {
+        fprintf(stderr, "Thread pool init failed\n");
+        return -1;
+    }
+    phys_set_thread_pool(&thread_pool);
+
+    err = run(broadphase, n_entities, pin_ratio, n_ticks, ns_per_tick,
+              col_ns_per_tick);
+
+    phys_set_thread_pool(NULL);
+    thread_pool_cleanup(&thread_pool);
+
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned n_ticks = 20;
+    float pin_ratio = 0.1f;
+    unsigned max_threads = 1;
+    const size_t *counts = default_counts;
+    size_t n_counts = ARRAY_SIZE(default_counts);
+    size_t *arg_counts = NULL;
+    double ns_per_tick, col_ns_per_tick, serial_col_ns;
+    unsigned n_threads;
+    long n_cpus;
+    size_t i, j;
+    int ret = 0;
+
+    if (argc > 1)
+        n_ticks = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        pin_ratio = strtof(argv[2], NULL);
+    if (argc > 3)
+        max_threads = strtoul(argv[3], NULL, 0);
+    if (argc > 4) {
+        n_counts = argc - 4;
+        arg_counts = malloc(sizeof(*arg_counts) * n_counts);
+        for (i = 0; i < n_counts; ++i)
+            arg_counts[i] = strtoul(argv[i + 4], NULL, 0);
+        counts = arg_counts;
+    }
+
+    if (!n_ticks) {
+        fprintf(stderr, "Tick count has to be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!max_threads) {
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_threads = n_cpus > 0 ? n_cpus : 1;
+    }
+
+    printf("backend,threads,entities,pins,ns_per_tick,ns_per_entity,"
+           "col_ns_per_tick,col_speedup\n");
+    for (i = 0; i < ARRAY_SIZE(backends); ++i) {
+        for (j = 0; j < n_counts; ++j) {
+            serial_col_ns = 0.0;
+            for (n_threads = 1; n_threads <= max_threads;
+                 n_threads = next_thread_count(n_threads, max_threads)) {
+                if (run_threads(backends[i].broadphase, counts[j], pin_ratio,
+                                n_ticks, n_threads, &ns_per_tick,
+                                &col_ns_per_tick) < 0) {
+                    ret = EXIT_FAILURE;
+                    goto out;
+                }
+                if (n_threads == 1)
+                    serial_col_ns = col_ns_per_tick;
+                printf("%s,%u,%zu,%zu,%.0f,%.2f,%.0f,%.2f\n",
+                       backends[i].name, n_threads, counts[j],
+                       (size_t)(counts[j] * pin_ratio), ns_per_tick,
+                       ns_per_tick / counts[j], col_ns_per_tick,
+                       col_ns_per_tick ? serial_col_ns / col_ns_per_tick :
+                                         0.0);
+                fflush(stdout);
+            }
+        }
+    }
+
+out:
+    free(arg_counts);
+
+    return ret;
+}
@@ -0,0 +1,95 @@
+#include "cull.h"
+#include "vec_simd.h"
+
+static inline unsigned cull_test4(const struct cull_view *view, vec_f4 x,
+                                  vec_f4 y, vec_f4 s)
+{
+    return vec_f4_le(vec_f4_set1(view->min.x), vec_f4_add(x, s)) &
+           vec_f4_le(vec_f4_sub(x, s), vec_f4_set1(view->max.x)) &
+           vec_f4_le(vec_f4_set1(view->min.y), vec_f4_add(y, s)) &
+           vec_f4_le(vec_f4_sub(y, s), vec_f4_set1(view->max.y));
+}
+
+static inline unsigned cull_test1(const struct cull_view *view,
+                                  struct vec3 p, float s)
+{
+    return (view->min.x <= p.x + s) & (p.x - s <= view->max.x) &
+           (view->min.y <= p.y + s) & (p.y - s <= view->max.y);
+}
+
+void cull_pack_box(const struct cull_view *view, struct vec3 *min,
+                   struct vec3 *max)
+{
+    const struct vec3 margin = {
+        CULL_MAX_SCALE, CULL_MAX_SCALE, CULL_MAX_SCALE
+    };
+
+    *min = vec3_sub(view->min, margin);
+    *max = vec3_add(view->max, margin);
+}
+
+/* The position and the scale share a vector, offset and scaled together */
+static inline void cull_pack(struct cull_instance *dst, vec_f4 offset,
+                             vec_f4 k, const float *pos, float scale,
+                             struct vec3 color)
+{
+    vec_f4_store_u16(dst->pos_scale,
+                     vec_f4_mul(vec_f4_sub(vec_f4_set(pos[0], pos[1], pos[2],
+                                                      scale), offset), k));
+    vec_f4_store_u8(dst->color,
+                    vec_f4_mul(vec_f4_set(color.x, color.y, color.z, 1.0f),
+                               vec_f4_set1(255.0f)));
+}
+
+size_t cull_compact(const struct cull_view *view,
+                    struct cull_instance *restrict dst,
+                    const struct phys_pos_comp *prev,
+                    const struct phys_pos_comp *cur,
+                    const struct vec3 *src_color, const float *src_scale,
+                    size_t n, float alpha)
+{
+    const vec_f4 a = vec_f4_set1(alpha);
+    struct vec3 min, max;
+    vec_f4 offset, k;
+    float lerp[12];
+    struct phys_pos_comp tail[3];
+    vec_f4 p, c;
+    unsigned visible;
+    size_t i, j, n_visible = 0;
+
+    cull_pack_box(view, &min, &max);
+    offset = vec_f4_set(min.x, min.y, min.z, 0.0f);
+    k = vec_f4_set(65535.0f / (max.x - min.x), 65535.0f / (max.y - min.y),
+                   65535.0f / (max.z - min.z), 65535.0f / CULL_MAX_SCALE);
+
+    /* Four positions are three vectors worth of floats */
+    for (i = 0; i + 4 <= n; i += 4) {
+        for (j = 0; j < 12; j += 4) {
+            p = vec_f4_load((const float *)(prev + i) + j);
+            c = vec_f4_load((const float *)(cur + i) + j);
+            vec_f4_store(lerp + j,
+                         vec_f4_add(p, vec_f4_mul(vec_f4_sub(c, p), a)));
+        }
+
+        visible = cull_test4(view,
+                             vec_f4_set(lerp[0], lerp[3], lerp[6], lerp[9]),
+                             vec_f4_set(lerp[1], lerp[4], lerp[7], lerp[10]),
+                             vec_f4_load(src_scale + i));
+
+        for (j = 0; j < 4; ++j) {
+            cull_pack(dst + n_visible, offset, k, lerp + 3 * j,
+                      src_scale[i + j], src_color[i + j]);
+            n_visible += visible >> j & 1;
+        }
+    }
+
+    /* The last n % 4 */
+    phys_pos_lerp(tail, prev + i, cur + i, n - i, alpha);
+    for (j = 0; i < n; ++i, ++j) {
+        cull_pack(dst + n_visible, offset, k, tail[j].pos.e, src_scale[i],
+                  src_color[i]);
+        n_visible += cull_test1(view, tail[j].pos, src_scale[i]);
+    }
+
+    return n_visible;
+}
@@ -0,0 +1,56 @@
+#ifndef CULL_H
+#define CULL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vec3.h"
+#include "phys.h"
+
+/*
+ * View area in world coordinates, only x and y are used. An instance is kept
+ * when its quad, which reaches scale away from its position, overlaps it.
+ */
+struct cull_view {
+    struct vec3 min;
+    struct vec3 max;
+};
+
+/* Largest scale an instance can be packed with */
+#define CULL_MAX_SCALE 1.0f
+
+/*
+ * Instance as uploaded for rendering, 12 bytes against the 28 of the float
+ * components, decoded by particle_vs.glsl. The position is 16 bit unsigned
+ * normalised over the pack box of the view and the scale over
+ * [0, CULL_MAX_SCALE], the colour is RGBA8 with an opaque alpha.
+ */
+struct cull_instance {
+    uint16_t pos_scale[4]; /* x, y, z and the scale */
+    uint8_t color[4];
+};
+
+/*
+ * Box the positions are packed in, the view grown by CULL_MAX_SCALE, which
+ * holds the position of every instance that's visible
+ */
+void cull_pack_box(const struct cull_view *view, struct vec3 *min,
+                   struct vec3 *max);
+
+/*
+ * Interpolates the positions between prev and cur like phys_pos_lerp() and
+ * writes the visible instances packed to the front of dst, which has to have
+ * room for all n. Returns the number of visible instances.
+ *
+ * The instances are tested four at a time and written out without branching
+ * on the result, each one being stored at the current end of the output
+ * which is only advanced past it when it's visible.
+ */
+size_t cull_compact(const struct cull_view *view,
+                    struct cull_instance *restrict dst,
+                    const struct phys_pos_comp *prev,
+                    const struct phys_pos_comp *cur,
+                    const struct vec3 *src_color, const float *src_scale,
+                    size_t n, float alpha);
+
+#endif
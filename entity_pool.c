@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "entity_pool.h"
+#include "decs/sb.h"
+
+void entity_pool_init(struct entity_pool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+}
+
+uint64_t entity_pool_register_comp(struct entity_pool *pool,
+                                   struct decs *decs, const char *name,
+                                   size_t size)
+{
+    uint64_t comp_id = decs_register_comp(decs, name, size);
+
+    if (!entity_pool_set_comp_size(pool, comp_id, size))
+        pool->comp_names[comp_id] = name;
+
+    return comp_id;
+}
+
+int entity_pool_set_comp_size(struct entity_pool *pool, uint64_t comp_id,
+                              size_t size)
+{
+    if (comp_id >= ENTITY_POOL_MAX_COMPS) {
+        fprintf(stderr, "Component id %" PRIu64 " is past the %d supported\n",
+                comp_id, ENTITY_POOL_MAX_COMPS);
+        return -1;
+    }
+
+    pool->comp_sizes[comp_id] = size;
+
+    return 0;
+}
+
+/* decs has no way to reserve entities up front */
+static void entity_pool_reserve(struct decs *decs, size_t n)
+{
+    while (sb_size(decs->entity_comp_map) < n)
+        decs_alloc_entity(decs, 0);
+}
+
+static void entity_pool_move(struct entity_pool *pool, struct decs *decs,
+                             uint64_t dst, uint64_t src)
+{
+    uint64_t mask = decs->entity_comp_map[src];
+    uint64_t comp_id;
+    size_t size;
+    char *data;
+
+    for (comp_id = 0; mask; ++comp_id, mask >>= 1) {
+        if (!(mask & 1))
+            continue;
+        size = pool->comp_sizes[comp_id];
+        data = decs->comps[comp_id].data;
+        memcpy(data + dst * size, data + src * size, size);
+    }
+
+    decs->entity_comp_map[dst] = decs->entity_comp_map[src];
+    decs->entity_comp_map[src] = 0;
+}
+
+/* Index of the archetype of comp_mask, which is added after the others */
+static size_t entity_pool_archetype(struct entity_pool *pool,
+                                    uint64_t comp_mask)
+{
+    size_t i;
+
+    for (i = 0; i < pool->n_archetypes; ++i) {
+        if (pool->archetypes[i].comp_mask == comp_mask)
+            return i;
+    }
+
+    if (pool->n_archetypes + 1 >= pool->n_allocd_archetypes) {
+        if (!pool->n_allocd_archetypes)
+            pool->n_allocd_archetypes = 1;
+        pool->n_allocd_archetypes *= 2;
+        pool->archetypes = realloc(pool->archetypes,
+                                   sizeof(*pool->archetypes) *
+                                   pool->n_allocd_archetypes);
+    }
+
+    pool->archetypes[i] = (struct entity_pool_archetype) {
+        .comp_mask = comp_mask,
+        .first = pool->n_live,
+    };
+    ++pool->n_archetypes;
+
+    return i;
+}
+
+/* The archetype whose range holds eid, which has to be live */
+static struct entity_pool_archetype *
+entity_pool_archetype_of(struct entity_pool *pool, uint64_t eid)
+{
+    size_t i = pool->n_archetypes;
+
+    while (pool->archetypes[--i].first > eid)
+        ;
+
+    return pool->archetypes + i;
+}
+
+/*
+ * Moves the range of arch to start at first. The slots it moves into have to
+ * be free, and only as many entities as it moves by are moved, from one end
+ * of the range to the other.
+ */
+static void entity_pool_shift(struct entity_pool *pool, struct decs *decs,
+                              struct entity_pool_archetype *arch,
+                              uint64_t first)
+{
+    uint64_t d, n_moved, i;
+
+    if (first > arch->first) {
+        d = first - arch->first;
+        n_moved = d < arch->n ? d : arch->n;
+        for (i = 0; i < n_moved; ++i)
+            entity_pool_move(pool, decs, first + arch->n - n_moved + i,
+                             arch->first + i);
+    } else {
+        d = arch->first - first;
+        n_moved = d < arch->n ? d : arch->n;
+        for (i = 0; i < n_moved; ++i)
+            entity_pool_move(pool, decs, first + i,
+                             arch->first + arch->n - n_moved + i);
+    }
+
+    arch->first = first;
+}
+
+/*
+ * Makes room for n entities at the end of the range of the archetype idx by
+ * shifting the ones after it, starting from the last
+ */
+static uint64_t entity_pool_open_slots(struct entity_pool *pool,
+                                       struct decs *decs, size_t idx, size_t n)
+{
+    struct entity_pool_archetype *arch;
+    size_t i;
+
+    entity_pool_reserve(decs, pool->n_live + n);
+
+    for (i = pool->n_archetypes - 1; i > idx; --i) {
+        arch = pool->archetypes + i;
+        entity_pool_shift(pool, decs, arch, arch->first + n);
+    }
+
+    arch = pool->archetypes + idx;
+    arch->n += n;
+    pool->n_live += n;
+
+    return arch->first + arch->n - n;
+}
+
+uint64_t entity_pool_alloc(struct entity_pool *pool, struct decs *decs,
+                           uint64_t comp_mask)
+{
+    return entity_pool_alloc_range(pool, decs, comp_mask, 1);
+}
+
+uint64_t entity_pool_alloc_range(struct entity_pool *pool,
+                                 struct decs *decs, uint64_t comp_mask,
+                                 size_t n)
+{
+    size_t idx = entity_pool_archetype(pool, comp_mask);
+    uint64_t first = entity_pool_open_slots(pool, decs, idx, n);
+    uint64_t *comp_map = decs->entity_comp_map + first;
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        comp_map[i] = comp_mask;
+
+    return first;
+}
+
+static void entity_pool_queue(uint64_t **eids, size_t *n, size_t *n_allocd,
+                              uint64_t eid)
+{
+    if (*n + 1 >= *n_allocd) {
+        if (!*n_allocd)
+            *n_allocd = 1;
+        *n_allocd *= 2;
+        *eids = realloc(*eids, sizeof(**eids) * *n_allocd);
+    }
+
+    (*eids)[(*n)++] = eid;
+}
+
+void entity_pool_despawn(struct entity_pool *pool, uint64_t eid)
+{
+    entity_pool_queue(&pool->despawned, &pool->n_despawned,
+                      &pool->n_allocd_despawned, eid);
+}
+
+void entity_pool_set_mask(struct entity_pool *pool, struct decs *decs,
+                          uint64_t eid, uint64_t comp_mask)
+{
+    decs->entity_comp_map[eid] = comp_mask;
+    entity_pool_queue(&pool->retyped, &pool->n_retyped,
+                      &pool->n_allocd_retyped, eid);
+}
+
+/* Fills a hole left under the new end of its archetype from the tail */
+static void entity_pool_fill(struct entity_pool *pool, struct decs *decs,
+                             uint64_t eid, size_t n_live)
+{
+    uint64_t *comp_map = decs->entity_comp_map;
+    struct entity_pool_archetype *arch;
+
+    if (eid >= n_live || comp_map[eid])
+        return;
+
+    arch = entity_pool_archetype_of(pool, eid);
+    if (eid >= arch->first + arch->n)
+        return;
+
+    while (!comp_map[arch->src - 1])
+        --arch->src;
+    entity_pool_move(pool, decs, eid, --arch->src);
+}
+
+/*
+ * The despawned entities are cleared first and the retyped ones are moved
+ * out past the live ones, after which the number of holes in the range of
+ * each archetype under its new end equals the number of entities above it.
+ * These holes are filled from the top, the ranges are then shifted together,
+ * which only moves as many entities as each one moves by, and the retyped
+ * entities are appended to their new archetypes.
+ */
+void entity_pool_tick(struct entity_pool *pool, struct decs *decs)
+{
+    struct entity_pool_archetype *arch;
+    size_t n_live = pool->n_live;
+    uint64_t staged = pool->n_live;
+    uint64_t *comp_map;
+    uint64_t eid, first;
+    size_t i, idx;
+
+    if (!pool->n_despawned && !pool->n_retyped)
+        return;
+
+    entity_pool_reserve(decs, n_live + pool->n_retyped);
+    comp_map = decs->entity_comp_map;
+
+    for (i = 0; i < pool->n_archetypes; ++i) {
+        arch = pool->archetypes + i;
+        arch->n_holes = 0;
+        arch->n_inserts = 0;
+        arch->src = arch->first + arch->n;
+    }
+
+    for (i = 0; i < pool->n_despawned; ++i) {
+        eid = pool->despawned[i];
+        if (eid < n_live && comp_map[eid]) {
+            comp_map[eid] = 0;
+            ++entity_pool_archetype_of(pool, eid)->n_holes;
+        }
+    }
+
+    for (i = 0; i < pool->n_retyped; ++i) {
+        eid = pool->retyped[i];
+        if (eid >= n_live || !comp_map[eid])
+            continue;
+        arch = entity_pool_archetype_of(pool, eid);
+        if (comp_map[eid] == arch->comp_mask)
+            continue;
+        entity_pool_move(pool, decs, staged++, eid);
+        ++arch->n_holes;
+    }
+
+    for (i = 0; i < pool->n_archetypes; ++i) {
+        arch = pool->archetypes + i;
+        arch->n -= arch->n_holes;
+    }
+
+    for (i = 0; i < pool->n_despawned; ++i)
+        entity_pool_fill(pool, decs, pool->despawned[i], n_live);
+    for (i = 0; i < pool->n_retyped; ++i)
+        entity_pool_fill(pool, decs, pool->retyped[i], n_live);
+
+    /* May add archetypes, which start out empty at the end */
+    for (eid = n_live; eid < staged; ++eid) {
+        idx = entity_pool_archetype(pool, comp_map[eid]);
+        ++pool->archetypes[idx].n_inserts;
+    }
+
+    /*
+     * The ranges moving down are shifted first, from the bottom, and the
+     * ones moving up after them, from the top, so that each one moves into
+     * slots which have already been cleared
+     */
+    first = 0;
+    for (i = 0; i < pool->n_archetypes; ++i) {
+        arch = pool->archetypes + i;
+        if (first <= arch->first)
+            entity_pool_shift(pool, decs, arch, first);
+        first += arch->n + arch->n_inserts;
+    }
+    pool->n_live = first;
+    for (i = pool->n_archetypes; i--;) {
+        arch = pool->archetypes + i;
+        first -= arch->n + arch->n_inserts;
+        if (first > arch->first)
+            entity_pool_shift(pool, decs, arch, first);
+    }
+
+    for (eid = n_live; eid < staged; ++eid) {
+        idx = entity_pool_archetype(pool, comp_map[eid]);
+        arch = pool->archetypes + idx;
+        entity_pool_move(pool, decs, arch->first + arch->n++, eid);
+    }
+
+    pool->n_despawned = 0;
+    pool->n_retyped = 0;
+}
+
+/*
+ * Ungrouped entities are moved out past the live ones and appended back to
+ * their archetypes a run of the same mask at a time
+ */
+void entity_pool_load(struct entity_pool *pool, struct decs *decs,
+                      size_t n_live)
+{
+    struct entity_pool_archetype *arch;
+    uint64_t *comp_map = decs->entity_comp_map;
+    uint64_t eid, end, first, i;
+    bool grouped = true;
+    size_t idx;
+
+    pool->n_archetypes = 0;
+    pool->n_live = 0;
+    pool->n_despawned = 0;
+    pool->n_retyped = 0;
+
+    for (eid = 0; eid < n_live && grouped; eid = end) {
+        for (end = eid + 1; end < n_live && comp_map[end] == comp_map[eid];
+             ++end)
+            ;
+        idx = entity_pool_archetype(pool, comp_map[eid]);
+        arch = pool->archetypes + idx;
+        grouped = !arch->n;
+        arch->n += end - eid;
+        pool->n_live = end;
+    }
+    if (grouped)
+        return;
+
+    entity_pool_reserve(decs, 2 * n_live);
+    comp_map = decs->entity_comp_map;
+    for (eid = 0; eid < n_live; ++eid)
+        entity_pool_move(pool, decs, n_live + eid, eid);
+
+    pool->n_archetypes = 0;
+    pool->n_live = 0;
+
+    for (eid = n_live; eid < 2 * n_live; eid = end) {
+        for (end = eid + 1;
+             end < 2 * n_live && comp_map[end] == comp_map[eid]; ++end)
+            ;
+        idx = entity_pool_archetype(pool, comp_map[eid]);
+        first = entity_pool_open_slots(pool, decs, idx, end - eid);
+        for (i = 0; i < end - eid; ++i)
+            entity_pool_move(pool, decs, first + i, eid + i);
+    }
+}
+
+void entity_pool_cleanup(struct entity_pool *pool)
+{
+    free(pool->archetypes);
+    free(pool->despawned);
+    free(pool->retyped);
+}
@@ -0,0 +1,127 @@
+#ifndef ENTITY_POOL_H
+#define ENTITY_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decs.h"
+
+#define ENTITY_POOL_MAX_COMPS 64
+
+/*
+ * Keeps the live entities packed at the start of the component arrays,
+ * grouped by their component masks. The entities of each archetype, those
+ * with the same mask, take up a range of their own, so that a system only
+ * meets runs of entities it either runs on as a whole or skips as a whole.
+ *
+ * Despawned entities are queued while the systems run and freed by
+ * entity_pool_tick(), which moves the last entities of their archetypes into
+ * the holes and closes the gaps left between the archetypes. The slots past
+ * the live ones have an empty component mask and are handed out again by
+ * entity_pool_alloc() before any new ones are allocated from decs.
+ *
+ * All of the entities have to be allocated through the pool and the sizes of
+ * their components have to be known to it for the moves. Masks of live
+ * entities are changed with entity_pool_set_mask(), which has the entity
+ * moved to its new archetype.
+ */
+struct entity_pool_archetype {
+    uint64_t comp_mask;
+    uint64_t first;
+    size_t n;
+
+    /* Scratch of entity_pool_tick() */
+    size_t n_holes;
+    size_t n_inserts;
+    uint64_t src;
+};
+
+struct entity_pool {
+    size_t comp_sizes[ENTITY_POOL_MAX_COMPS];
+    const char *comp_names[ENTITY_POOL_MAX_COMPS];
+    size_t n_live;
+
+    /* In the order of their ranges */
+    struct entity_pool_archetype *archetypes;
+    size_t n_archetypes;
+    size_t n_allocd_archetypes;
+
+    /* Despawned during the current tick, may contain duplicates */
+    uint64_t *despawned;
+    size_t n_despawned;
+    size_t n_allocd_despawned;
+
+    /* Mask changed during the current tick, may contain duplicates */
+    uint64_t *retyped;
+    size_t n_retyped;
+    size_t n_allocd_retyped;
+};
+
+void entity_pool_init(struct entity_pool *pool);
+
+/*
+ * decs_register_comp() which also records the size and the name of the
+ * component, the name has to outlive the pool
+ */
+uint64_t entity_pool_register_comp(struct entity_pool *pool,
+                                   struct decs *decs, const char *name,
+                                   size_t size);
+
+/*
+ * For components registered without entity_pool_register_comp(), fails for
+ * ids past ENTITY_POOL_MAX_COMPS
+ */
+int entity_pool_set_comp_size(struct entity_pool *pool, uint64_t comp_id,
+                              size_t size);
+
+/*
+ * Returns a free slot at the end of the range of comp_mask with its mask set.
+ * The components of a reused slot hold stale data and have to be initialised
+ * by the caller. Room is made by moving entities of the archetypes after it,
+ * whose ids change.
+ */
+uint64_t entity_pool_alloc(struct entity_pool *pool, struct decs *decs,
+                           uint64_t comp_mask);
+
+/*
+ * Allocates n slots at once, the entities [first, first + n) being returned
+ * as first. The live entities are packed, so the components of the range are
+ * contiguous in the component arrays and start at decs_get_comp() of first.
+ * The pointers are only valid until the next allocation, which may grow the
+ * arrays.
+ */
+uint64_t entity_pool_alloc_range(struct entity_pool *pool,
+                                 struct decs *decs, uint64_t comp_mask,
+                                 size_t n);
+
+/*
+ * Marks eid for removal. Serial systems only: the queue isn't locked, so it
+ * can't be called from the chunks a batch system runs on the thread pool.
+ */
+void entity_pool_despawn(struct entity_pool *pool, uint64_t eid);
+
+/*
+ * Sets the mask of eid right away, it's moved to the range of the new mask by
+ * the next entity_pool_tick(). The components which are only in the new mask
+ * have to be initialised before then.
+ */
+void entity_pool_set_mask(struct entity_pool *pool, struct decs *decs,
+                          uint64_t eid, uint64_t comp_mask);
+
+/*
+ * Frees the entities despawned and regroups the ones retyped since the last
+ * call, to be called between decs_tick() calls. The entity ids are not stable
+ * across this.
+ */
+void entity_pool_tick(struct entity_pool *pool, struct decs *decs);
+
+/*
+ * Takes over the first n_live entities of decs, as loaded from a snapshot,
+ * which are regrouped if their archetypes aren't in ranges of their own
+ */
+void entity_pool_load(struct entity_pool *pool, struct decs *decs,
+                      size_t n_live);
+
+void entity_pool_cleanup(struct entity_pool *pool);
+
+#endif
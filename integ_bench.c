@@ -0,0 +1,224 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "phys.h"
+#include "phys_kernels.h"
+
+/*
+ * Integrator accuracy benchmark. A single particle with the gravity and drag
+ * of the phys systems is thrown with each integrator at a range of time
+ * steps and compared against a double precision RK4 reference run at a tiny
+ * step. Printed as CSV are the largest position error and the largest
+ * mechanical energy error, relative to the initial energy, seen over the
+ * run, followed by the largest step keeping the position error under the
+ * tolerance and what a simulated second costs at that step.
+ *
+ * Usage: integ_bench [seconds] [tolerance]
+ */
+
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+#define INTEG_MASS 7.0f
+/* As applied by phys_gravity, a force rather than an acceleration */
+#define INTEG_GRAVITY 9.81f
+#define INTEG_REF_DT 1e-5
+
+/* Bodies of the cost measurement and the number of passes over them */
+#define INTEG_COST_N 4096
+#define INTEG_COST_PASSES 200
+
+static const double dts[] = {
+    1.0 / 3840.0, 1.0 / 1920.0, 1.0 / 960.0, 1.0 / 480.0, 1.0 / 240.0,
+    1.0 / 120.0, 1.0 / 60.0, 1.0 / 30.0, 1.0 / 15.0, 1.0 / 8.0, 1.0 / 4.0,
+};
+
+struct integ_state {
+    double pos[3];
+    double vel[3];
+};
+
+static const struct integ_state start = {
+    .pos = { 0.0, 0.0, 0.0 },
+    .vel = { 1.5, 4.0, 0.0 },
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void ref_acc(const double vel[3], double acc[3])
+{
+    int j;
+
+    for (j = 0; j < 3; ++j)
+        acc[j] = vel[j] * fabs(vel[j]) * PHYS_TOTAL_DRAG_COEF;
+    acc[1] -= INTEG_GRAVITY;
+    for (j = 0; j < 3; ++j)
+        acc[j] /= INTEG_MASS;
+}
+
+/* The acceleration only depends on the velocity */
+static void ref_step(struct integ_state *s, double dt)
+{
+    double v[4][3], a[4][3];
+    int j;
+
+    for (j = 0; j < 3; ++j)
+        v[0][j] = s->vel[j];
+    ref_acc(v[0], a[0]);
+    for (j = 0; j < 3; ++j)
+        v[1][j] = s->vel[j] + a[0][j] * 0.5 * dt;
+    ref_acc(v[1], a[1]);
+    for (j = 0; j < 3; ++j)
+        v[2][j] = s->vel[j] + a[1][j] * 0.5 * dt;
+    ref_acc(v[2], a[2]);
+    for (j = 0; j < 3; ++j)
+        v[3][j] = s->vel[j] + a[2][j] * dt;
+    ref_acc(v[3], a[3]);
+
+    for (j = 0; j < 3; ++j) {
+        s->pos[j] += (v[0][j] + 2.0 * (v[1][j] + v[2][j]) + v[3][j]) *
+                     dt / 6.0;
+        s->vel[j] += (a[0][j] + 2.0 * (a[1][j] + a[2][j]) + a[3][j]) *
+                     dt / 6.0;
+    }
+}
+
+static double energy(const double pos[3], const double vel[3])
+{
+    return 0.5 * INTEG_MASS * (vel[0] * vel[0] + vel[1] * vel[1] +
+                               vel[2] * vel[2]) +
+           INTEG_GRAVITY * pos[1];
+}
+
+/* The force the gravity and drag systems accumulate for an entity at vel */
+static struct vec3 phys_force(struct vec3 vel)
+{
+    const float k = PHYS_TOTAL_DRAG_COEF;
+
+    return (struct vec3) {
+        vel.x * fabsf(vel.x) * k,
+        vel.y * fabsf(vel.y) * k - INTEG_GRAVITY,
+        vel.z * fabsf(vel.z) * k,
+    };
+}
+
+static void run(enum phys_integrator integrator, double dt, double seconds,
+                double *pos_err, double *energy_err)
+{
+    struct integ_state ref = start;
+    struct vec3 pos = { start.pos[0], start.pos[1], start.pos[2] };
+    struct vec3 vel = { start.vel[0], start.vel[1], start.vel[2] };
+    struct vec3 d_pos;
+    const unsigned n_steps = seconds / dt + 0.5;
+    const unsigned n_ref_steps = ceil(dt / INTEG_REF_DT);
+    const double e0 = energy(start.pos, start.vel);
+    double p[3], v[3];
+    double err;
+    unsigned i, j;
+
+    *pos_err = 0.0;
+    *energy_err = 0.0;
+
+    for (i = 0; i < n_steps; ++i) {
+        phys_integrate(&vel, &d_pos, phys_force(vel), INTEG_MASS, dt,
+                       integrator);
+        pos = vec3_add(pos, d_pos);
+
+        for (j = 0; j < n_ref_steps; ++j)
+            ref_step(&ref, dt / n_ref_steps);
+
+        p[0] = pos.x - ref.pos[0];
+        p[1] = pos.y - ref.pos[1];
+        p[2] = pos.z - ref.pos[2];
+        err = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        if (!isfinite(err)) {
+            *pos_err = *energy_err = INFINITY;
+            return;
+        }
+        if (err > *pos_err)
+            *pos_err = err;
+
+        p[0] = pos.x, p[1] = pos.y, p[2] = pos.z;
+        v[0] = vel.x, v[1] = vel.y, v[2] = vel.z;
+        err = fabs(energy(p, v) - energy(ref.pos, ref.vel)) / e0;
+        if (err > *energy_err)
+            *energy_err = err;
+    }
+}
+
+/* Wall clock time of one integration step of one entity */
+static double step_cost(enum phys_integrator integrator)
+{
+    static struct phys_dyn_comp dyn[INTEG_COST_N];
+    double start_ns;
+    unsigned pass;
+    size_t i;
+
+    for (i = 0; i < INTEG_COST_N; ++i) {
+        dyn[i].vel = (struct vec3){ start.vel[0], start.vel[1], 0.0f };
+        dyn[i].mass = INTEG_MASS;
+    }
+
+    start_ns = now_ns();
+    for (pass = 0; pass < INTEG_COST_PASSES; ++pass) {
+        for (i = 0; i < INTEG_COST_N; ++i) {
+            phys_integrate(&dyn[i].vel, &dyn[i].d_pos,
+                           phys_force(dyn[i].vel), dyn[i].mass, 1.0f / 60.0f,
+                           integrator);
+        }
+    }
+
+    return (now_ns() - start_ns) / ((double)INTEG_COST_N * INTEG_COST_PASSES);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 4.0;
+    double tolerance = 2e-3; /* About a pixel at 1080p */
+    double max_dts[PHYS_N_INTEGRATORS];
+    double pos_err, energy_err, cost;
+    enum phys_integrator integrator;
+    size_t i;
+
+    if (argc > 1)
+        seconds = strtod(argv[1], NULL);
+    if (argc > 2)
+        tolerance = strtod(argv[2], NULL);
+
+    if (seconds <= 0.0) {
+        fprintf(stderr, "Simulated time has to be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("integrator,dt,pos_err,energy_err\n");
+    for (integrator = 0; integrator < PHYS_N_INTEGRATORS; ++integrator) {
+        max_dts[integrator] = 0.0;
+        for (i = 0; i < ARRAY_SIZE(dts); ++i) {
+            run(integrator, dts[i], seconds, &pos_err, &energy_err);
+            printf("%s,%g,%g,%g\n", phys_integrator_name(integrator), dts[i],
+                   pos_err, energy_err);
+            if (pos_err <= tolerance && dts[i] > max_dts[integrator])
+                max_dts[integrator] = dts[i];
+        }
+    }
+
+    printf("\nintegrator,max_dt,ns_per_step,ns_per_sim_second\n");
+    for (integrator = 0; integrator < PHYS_N_INTEGRATORS; ++integrator) {
+        cost = step_cost(integrator);
+        printf("%s,%g,%.2f,%.2f\n", phys_integrator_name(integrator),
+               max_dts[integrator], cost,
+               max_dts[integrator] ? cost / max_dts[integrator] : INFINITY);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+#include "lifetime.h"
+#include "phys.h"
+
+static void lifetime_tick(struct decs *decs, uint64_t eid, void *func_data);
+
+struct lifetime_sys_ctx {
+    struct lifetime_ctx *lifetime_ctx; /* AUX */
+    struct lifetime_comp *lifetime_base;
+    struct phys_pos_comp *phys_pos_base;
+};
+
+const struct system_reg lifetime_sys = {
+    .name       = "lifetime",
+    .comps      = STR_ARR("lifetime", "phys_pos"),
+    .func       = lifetime_tick,
+};
+
+static void lifetime_tick(struct decs *decs, uint64_t eid, void *func_data)
+{
+    struct lifetime_sys_ctx *ctx = func_data;
+    struct lifetime_ctx *lifetime_ctx = ctx->lifetime_ctx;
+    struct lifetime_comp *lifetime = ctx->lifetime_base + eid;
+    struct vec3 pos = ctx->phys_pos_base[eid].pos;
+    struct vec3 min = lifetime_ctx->min;
+    struct vec3 max = lifetime_ctx->max;
+
+    lifetime->remaining -= lifetime_ctx->dt;
+
+    if (lifetime->remaining <= 0.0f ||
+        pos.x < min.x || pos.x > max.x ||
+        pos.y < min.y || pos.y > max.y ||
+        pos.z < min.z || pos.z > max.z)
+        entity_pool_despawn(lifetime_ctx->pool, eid);
+}
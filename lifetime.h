@@ -0,0 +1,26 @@
+#ifndef LIFETIME_H
+#define LIFETIME_H
+
+#include "decs.h"
+#include "vec3.h"
+#include "entity_pool.h"
+
+/* Seconds left until the entity is despawned */
+struct lifetime_comp {
+    float remaining;
+};
+
+/*
+ * Aux context of lifetime_sys. Entities whose time runs out or whose
+ * position leaves the [min, max] box are despawned through pool.
+ */
+struct lifetime_ctx {
+    struct entity_pool *pool;
+    struct vec3 min;
+    struct vec3 max;
+    float dt;
+};
+
+const struct system_reg lifetime_sys;
+
+#endif
@@ -0,0 +1,40 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mmap_file.h"
+
+void *mmap_file(const char *path, size_t *length)
+{
+    void *p = NULL;
+    int fd;
+    int ret;
+    struct stat st;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open failed");
+        return NULL;
+    }
+
+    ret = fstat(fd, &st);
+    if (ret < 0) {
+        perror("stat failed");
+        goto err_close;
+    }
+
+    if (length)
+        *length = st.st_size;
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap failed");
+        p = NULL;
+    }
+
+err_close:
+    close(fd);
+    return p;
+}
@@ -0,0 +1,12 @@
+#ifndef MMAP_FILE_H
+#define MMAP_FILE_H
+
+#include <stddef.h>
+
+/*
+ * Maps the whole file read only and stores its size in length, returns NULL
+ * on failure. The mapping is released with munmap().
+ */
+void *mmap_file(const char *path, size_t *length);
+
+#endif
@@ -1,5 +1,8 @@
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <sys/types.h>
 
@@ -12,28 +15,17 @@
 #include "phys.h"
 #include "shader.h"
 #include "decs/decs.h"
-#include "phys_sphere_col.h"
+#include "scene.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "timestep.h"
+#include "trace.h"
+#include "sys_perf.h"
+#include "cull.h"
 #include "decs/sb.h"
 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
 
-struct color_comp {
-    union {
-        struct vec3 color;
-        struct {
-            float r, g, b;
-        };
-    };
-};
-
-struct comp_ids {
-    uint64_t phys_pos;
-    uint64_t phys_dyn;
-    uint64_t color;
-    uint64_t scale;
-    uint64_t phys_sphere_col;
-};
-
 static const GLfloat triangle_verts[] = {
     -1.0f, -1.0f, 0.0f,
      1.0f, -1.0f, 0.0f,
@@ -43,78 +35,9 @@ static const GLfloat triangle_verts[] = {
 
 int win_w = 1280, win_h = 720;
 
-void create_particle(struct decs *decs, struct comp_ids *comp_ids,
-                     struct vec3 spawn_point)
-{
-    struct phys_pos_comp *phys_pos;
-    struct phys_dyn_comp *phys_dyn;
-    struct phys_sphere_comp *sph;
-    struct color_comp *color;
-    float *scale;
-    uint64_t eid;
-
-    eid = decs_alloc_entity(decs, (1<<comp_ids->phys_pos) |
-                                  (1<<comp_ids->phys_dyn) |
-                                  (1<<comp_ids->color) |
-                                  (1<<comp_ids->scale) |
-                                  (1<<comp_ids->phys_sphere_col));
-
-    phys_pos = decs_get_comp(decs, comp_ids->phys_pos, eid);
-    phys_dyn = decs_get_comp(decs, comp_ids->phys_dyn, eid);
-    color = decs_get_comp(decs, comp_ids->color, eid);
-    scale = decs_get_comp(decs, comp_ids->scale, eid);
-    sph = decs_get_comp(decs, comp_ids->phys_sphere_col, eid);
-
-    *color = (struct color_comp) {
-        sinf(eid * 0.001f) * 1 + 1.0f,
-        cosf(eid * 0.003f) * 0.25f + 0.50f,
-        sinf(eid * 0.002f) * 0.5f + 1.5f,
-    };
-
-    eid += rand();
-
-    *phys_pos = (struct phys_pos_comp) {
-        .pos = spawn_point,
-    };
-    *phys_dyn = (struct phys_dyn_comp) {
-        .vel = (struct vec3) {
-            cosf(eid * 0.05f) * 0.5f,
-            sinf(eid * 0.05f) * 0.5f,
-            0.0f,
-        },
-        .force = { 0.0f, 0.0f, 0.0f },
-        .mass = 7.0f
-    };
-
-    *scale = 0.01f + (sinf(eid * 0.007f) + 1.0f) * 0.01f;
-    sph->r = *scale * 0.5f;
-}
-
-static void create_pin(struct decs *decs, const struct comp_ids *comp_ids,
-                       const struct vec3 pos)
-{
-    struct phys_pos_comp *phys_pos;
-    struct color_comp *color;
-    struct phys_sphere_comp *sph;
-    float *scale;
-    uint64_t eid;
-
-    eid = decs_alloc_entity(decs, (1<<comp_ids->phys_pos) |
-                                  (1<<comp_ids->color) |
-                                  (1<<comp_ids->scale) |
-                                  (1<<comp_ids->phys_sphere_col));
-
-    phys_pos = decs_get_comp(decs, comp_ids->phys_pos, eid);
-    color = decs_get_comp(decs, comp_ids->color, eid);
-    scale = decs_get_comp(decs, comp_ids->scale, eid);
-    sph = decs_get_comp(decs, comp_ids->phys_sphere_col, eid);
-
-    *color = (struct color_comp) { 0.8f, 0.8f, 0.8f };
-    *phys_pos = (struct phys_pos_comp) { .pos = pos };
-
-    *scale = 0.25f;
-    sph->r = *scale * 1.0f;
-}
+static const char *snapshot_path = "particle.snap";
+static const char *trace_path = "particle_trace.json";
+static const char *perf_csv_path = "particle_perf.csv";
 
 static struct vec3 normalize_screen_coords(int x, int y)
 {
@@ -127,46 +50,53 @@ static struct vec3 normalize_screen_coords(int x, int y)
     return p;
 }
 
-static void render_system_perf_stats(const struct decs *decs)
+/* The moving averages of the selected fields, per tick and per entity */
+static void render_system_perf_stats(const struct sys_perf *perf,
+                                     const struct decs *decs)
 {
-    unsigned pt_size = 16;
-    unsigned i, j;
-    struct perf_stats *stats;
-
-    struct {
-        const char *name;
-        const size_t offset;
-    } prints[] = {
-        {
-            .name = "cpu cycles:     ",
-            .offset = offsetof(struct perf_stats, cpu_cycles),
-        }, {
-            .name = "l3 cache refs:  ",
-            .offset = offsetof(struct perf_stats, cache_refs),
-        }, {
-            .name = "l3 cache misses:",
-            .offset = offsetof(struct perf_stats, cpu_cycles),
-        }, {
-            .name = "branch instrs:  ",
-            .offset = offsetof(struct perf_stats, cache_refs),
-        }, {
-            .name = "branchs misses: ",
-            .offset = offsetof(struct perf_stats, cpu_cycles),
+    const unsigned pt_size = 16;
+    const struct sys_perf_sys *sys;
+    unsigned n_fields = 0;
+    unsigned line;
+    size_t i;
+    unsigned j;
+
+    for (j = 0; j < SYS_PERF_N_FIELDS; ++j)
+        n_fields += !!(perf->fields & (1u << j));
+
+    ttf_printf(0, 0, "entity count: %zu", perf->n_entities);
+    for (i = 0; i < perf->n_systems; ++i) {
+        sys = perf->systems + i;
+        line = 1 + i * (n_fields + 1);
+        ttf_printf(0, pt_size * line++, "%s:", decs->systems[i].name);
+        for (j = 0; j < SYS_PERF_N_FIELDS; ++j) {
+            if (!(perf->fields & (1u << j)))
+                continue;
+            ttf_printf(64, pt_size * line++, "%-14s %.0f, (%.2f)",
+                       sys_perf_field_name(j), sys->avg[j],
+                       perf->n_entities ? sys->avg[j] / perf->n_entities :
+                                          0.0);
         }
-    };
+    }
+}
 
-    const unsigned n_prints = ARRAY_SIZE(prints) + 1;
-
-    ttf_printf(0, 0, "entity count: %zu", sb_size(decs->entity_comp_map));
-    for (i = 0; i < sb_size(decs->systems); ++i) {
-        stats = &decs->systems[i].perf_stats;
-        ttf_printf(0, pt_size * (1 + i * n_prints), "%s:", decs->systems[i].name);
-        for (j = 0; j < ARRAY_SIZE(prints); ++j) {
-            long long val = ((long long *)stats)[j];
-            ttf_printf(64, pt_size * (2 + j + i * n_prints), "%s %d, (%.2f)",
-                       prints[j].name, val,
-                       (double)val / sb_size(decs->entity_comp_map));
-        }
+/*
+ * The wall clock times of the systems ticked by sys_sched, which leaves the
+ * decs perf stats untouched
+ */
+static void render_system_sched_stats(const struct sys_sched *sched,
+                                      size_t n_entities)
+{
+    const unsigned pt_size = 16;
+    const struct sys_sched_sys *sys;
+    size_t i;
+
+    ttf_printf(0, 0, "entity count: %zu", n_entities);
+    for (i = 0; i < sched->n_systems; ++i) {
+        sys = sched->systems + i;
+        ttf_printf(0, pt_size * (1 + i), "%-22s %8lu ns, (%.2f)",
+                   sys->reg->name, (unsigned long)sys->last_ns,
+                   n_entities ? sys->last_ns / (double)n_entities : 0.0);
     }
 }
 
@@ -177,16 +107,69 @@ enum {
     VA_IDX_SCALE,
 };
 
+/*
+ * The instances are packed into struct cull_instance and interleaved in a
+ * single buffer. With ARB_buffer_storage it's mapped persistently and split
+ * into RENDER_N_SEGMENTS segments of capacity instances each, used in turn. A
+ * fence is placed after the draw reading a segment and waited on before the
+ * segment is written again, so the CPU can fill one segment while the GPU is
+ * still reading the previous ones.
+ */
+#define RENDER_N_SEGMENTS 3
+#define RENDER_MIN_CAPACITY 4096
+
 struct render {
     GLuint vao_id;
     GLuint vertex_vbo_id;
-    GLuint particle_pos_vbo_id;
-    GLuint particle_color_vbo_id;
-    GLuint particle_scale_vbo_id;
+    GLuint instance_vbo_id;
     GLuint shader_prog_id;
 
+    bool persistent;
+    size_t capacity;
+    unsigned segment;
+    GLsync fences[RENDER_N_SEGMENTS];
+    struct cull_instance *instance_map;
+
+    /*
+     * Instances outside of the view aren't uploaded, the visible ones are
+     * written to the current segment or to these when the buffer isn't
+     * mapped
+     */
+    struct cull_view view;
+    struct cull_instance *staged;
+    size_t n_allocd_staged;
 };
 
+/* Decoding of the packed instances, see struct cull_instance */
+static void render_set_pack_uniforms(const struct render *r)
+{
+    GLuint prog = r->shader_prog_id;
+    struct vec3 min, max;
+
+    cull_pack_box(&r->view, &min, &max);
+
+    glUniform3f(glGetUniformLocation(prog, "pos_min"), min.x, min.y, min.z);
+    glUniform3f(glGetUniformLocation(prog, "pos_range"),
+                max.x - min.x, max.y - min.y, max.z - min.z);
+    glUniform1f(glGetUniformLocation(prog, "max_scale"), CULL_MAX_SCALE);
+}
+
+/* Points the instanced attributes at the instances from offset on */
+static void render_instance_attribs(size_t offset)
+{
+    const GLsizei stride = sizeof(struct cull_instance);
+    const size_t pos = offset + offsetof(struct cull_instance, pos_scale);
+    const size_t scale = pos + 3 * sizeof(uint16_t);
+    const size_t color = offset + offsetof(struct cull_instance, color);
+
+    glVertexAttribPointer(VA_IDX_POS, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                          (const void *)pos);
+    glVertexAttribPointer(VA_IDX_SCALE, 1, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                          (const void *)scale);
+    glVertexAttribPointer(VA_IDX_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                          (const void *)color);
+}
+
 int render_init(struct render *r)
 {
     GLuint vs_id;
@@ -204,6 +187,10 @@ int render_init(struct render *r)
     if (!r->shader_prog_id)
         return -1;
 
+    r->view = (struct cull_view) {
+        normalize_screen_coords(0, win_h), normalize_screen_coords(win_w, 0)
+    };
+
     glGenVertexArrays(1, &r->vao_id);
     glBindVertexArray(r->vao_id);
 
@@ -212,33 +199,21 @@ int render_init(struct render *r)
     glBufferData(GL_ARRAY_BUFFER, sizeof(triangle_verts), triangle_verts,
                  GL_STATIC_DRAW);
 
-    glGenBuffers(1, &r->particle_pos_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_pos_vbo_id);
-
-    glGenBuffers(1, &r->particle_color_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_color_vbo_id);
-
-    glGenBuffers(1, &r->particle_scale_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_scale_vbo_id);
+    glGenBuffers(1, &r->instance_vbo_id);
+    glBindBuffer(GL_ARRAY_BUFFER, r->instance_vbo_id);
 
     glUseProgram(r->shader_prog_id);
+    render_set_pack_uniforms(r);
 
     glEnableVertexAttribArray(VA_IDX_VERT);
     glBindBuffer(GL_ARRAY_BUFFER, r->vertex_vbo_id);
     glVertexAttribPointer(VA_IDX_VERT, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
     glEnableVertexAttribArray(VA_IDX_POS);
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_pos_vbo_id);
-    glVertexAttribPointer(VA_IDX_POS, 3, GL_FLOAT, GL_FALSE,
-                          sizeof(struct phys_dyn_comp), 0);
-
     glEnableVertexAttribArray(VA_IDX_COLOR);
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_color_vbo_id);
-    glVertexAttribPointer(VA_IDX_COLOR, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
     glEnableVertexAttribArray(VA_IDX_SCALE);
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_scale_vbo_id);
-    glVertexAttribPointer(VA_IDX_COLOR, 1, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, r->instance_vbo_id);
+    render_instance_attribs(0);
 
     glVertexAttribDivisor(VA_IDX_VERT, 0); /* Vertices aren't instanced */
     /* Particle positions and colors are unique to each instance */
@@ -246,36 +221,148 @@ int render_init(struct render *r)
     glVertexAttribDivisor(VA_IDX_COLOR, 1);
     glVertexAttribDivisor(VA_IDX_SCALE, 1);
 
+    r->persistent = GLEW_ARB_buffer_storage;
+    r->capacity = 0;
+    r->segment = 0;
+    memset(r->fences, 0, sizeof(r->fences));
+    r->instance_map = NULL;
+    r->staged = NULL;
+    r->n_allocd_staged = 0;
+
+    return 0;
+}
+
+static void render_wait_fence(GLsync *fence)
+{
+    if (!*fence)
+        return;
+
+    while (glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                            1000000000) == GL_TIMEOUT_EXPIRED)
+        ;
+    glDeleteSync(*fence);
+    *fence = NULL;
+}
+
+/*
+ * Storage is immutable, so growing means replacing the buffer, which may only
+ * happen once the GPU is done with all of the segments.
+ */
+static void *render_alloc_storage(GLuint *vbo_id, size_t size)
+{
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                             GL_MAP_COHERENT_BIT;
+
+    glDeleteBuffers(1, vbo_id);
+    glGenBuffers(1, vbo_id);
+    glBindBuffer(GL_ARRAY_BUFFER, *vbo_id);
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+
+    return glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+}
+
+static int render_reserve(struct render *r, size_t n_particles)
+{
+    size_t capacity = r->capacity ? r->capacity : RENDER_MIN_CAPACITY;
+    unsigned i;
+
+    if (n_particles <= r->capacity)
+        return 0;
+
+    while (capacity < n_particles)
+        capacity *= 2;
+
+    for (i = 0; i < RENDER_N_SEGMENTS; ++i)
+        render_wait_fence(&r->fences[i]);
+
+    r->instance_map =
+            render_alloc_storage(&r->instance_vbo_id,
+                                 RENDER_N_SEGMENTS * capacity *
+                                 sizeof(struct cull_instance));
+
+    if (!r->instance_map) {
+        fprintf(stderr, "Mapping the instance buffer failed, "
+                        "falling back to glBufferSubData\n");
+        /* The immutable buffer can't be respecified by glBufferData */
+        glDeleteBuffers(1, &r->instance_vbo_id);
+        glGenBuffers(1, &r->instance_vbo_id);
+        r->persistent = false;
+        r->capacity = 0;
+        return -1;
+    }
+
+    r->capacity = capacity;
+    r->segment = 0;
+
     return 0;
 }
 
-void render_do(const struct render *r, const struct decs *decs,
+/*
+ * Culls the particles against the view and writes the visible ones packed
+ * straight into the current segment of the mapped buffer, or into the
+ * staging array otherwise. Returns how many are visible.
+ */
+static size_t render_cull(struct render *r, const struct decs *decs,
+                          const struct comp_ids *comp_ids, size_t n,
+                          float alpha)
+{
+    struct cull_instance *dst;
+
+    if (r->persistent) {
+        dst = r->instance_map + r->segment * r->capacity;
+    } else {
+        if (n > r->n_allocd_staged) {
+            r->n_allocd_staged = n * 2;
+            r->staged = realloc(r->staged,
+                                r->n_allocd_staged * sizeof(*r->staged));
+        }
+        dst = r->staged;
+    }
+
+    return cull_compact(&r->view, dst,
+                        decs->comps[comp_ids->phys_prev_pos].data,
+                        decs->comps[comp_ids->phys_pos].data,
+                        decs->comps[comp_ids->color].data,
+                        decs->comps[comp_ids->scale].data, n, alpha);
+}
+
+/*
+ * Points the attributes at the n instances written by render_cull(), which
+ * are either in the current segment of the persistently mapped buffer
+ * already or are copied into a freshly orphaned one.
+ */
+static void render_upload(const struct render *r, size_t n)
+{
+    const size_t item_size = sizeof(struct cull_instance);
+    size_t offset = 0;
+
+    glBindBuffer(GL_ARRAY_BUFFER, r->instance_vbo_id);
+    if (r->persistent) {
+        offset = r->segment * r->capacity * item_size;
+    } else if (n) {
+        /* Nothing may have been staged yet */
+        glBufferData(GL_ARRAY_BUFFER, n * item_size, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, n * item_size, r->staged);
+    }
+    render_instance_attribs(offset);
+}
+
+/* alpha is the position between the last two ticks to draw the particles at */
+void render_do(struct render *r, const struct decs *decs,
                const struct comp_ids *comp_ids,
-               size_t n_particles)
+               size_t n_particles, float alpha)
 {
+    size_t n_visible;
+
     glBindVertexArray(r->vao_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_pos_vbo_id);
-    glBufferData(GL_ARRAY_BUFFER,
-                 n_particles * sizeof(struct phys_pos_comp), NULL,
-                 GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0,
-                    n_particles * sizeof(struct phys_pos_comp),
-                    decs->comps[comp_ids->phys_pos].data);
-    glVertexAttribPointer(VA_IDX_POS, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_color_vbo_id);
-    glBufferData(GL_ARRAY_BUFFER, n_particles * sizeof(struct vec3), NULL,
-                 GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, n_particles * sizeof(struct vec3),
-                    decs->comps[comp_ids->color].data);
-    glVertexAttribPointer(VA_IDX_COLOR, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, r->particle_scale_vbo_id);
-    glBufferData(GL_ARRAY_BUFFER, n_particles * sizeof(float), NULL,
-                 GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, n_particles * sizeof(float),
-                    decs->comps[comp_ids->scale].data);
-    glVertexAttribPointer(VA_IDX_SCALE, 1, GL_FLOAT, GL_FALSE, 0, 0);
+
+    if (r->persistent) {
+        render_reserve(r, n_particles);
+        render_wait_fence(&r->fences[r->segment]);
+    }
+
+    n_visible = render_cull(r, decs, comp_ids, n_particles, alpha);
+    render_upload(r, n_visible);
 
     glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -287,43 +374,67 @@ void render_do(const struct render *r, const struct decs *decs,
 
     glUseProgram(r->shader_prog_id);
 
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, n_particles);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, n_visible);
+
+    if (r->persistent) {
+        r->fences[r->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        r->segment = (r->segment + 1) % RENDER_N_SEGMENTS;
+    }
 
     glDisableVertexAttribArray(VA_IDX_VERT);
     glDisableVertexAttribArray(VA_IDX_POS);
     glDisableVertexAttribArray(VA_IDX_SCALE);
 }
 
-int main(void)
+void render_cleanup(struct render *r)
+{
+    unsigned i;
+
+    for (i = 0; i < RENDER_N_SEGMENTS; ++i)
+        render_wait_fence(&r->fences[i]);
+
+    if (r->instance_map) {
+        glBindBuffer(GL_ARRAY_BUFFER, r->instance_vbo_id);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        r->instance_map = NULL;
+    }
+
+    glDeleteBuffers(1, &r->instance_vbo_id);
+    glDeleteBuffers(1, &r->vertex_vbo_id);
+    glDeleteVertexArrays(1, &r->vao_id);
+    glDeleteProgram(r->shader_prog_id);
+    free(r->staged);
+}
+
+/* Usage: particle [tick dt] [max ticks per frame] */
+int main(int argc, char **argv)
 {
-    struct decs decs;
-    struct comp_ids comp_ids;
+    struct scene scene;
     int running = 1;
     int ret = 0;
     int err;
-    int i;
 
     struct vec3 spawn_point = { 0.0f, 0.25f, 0.0f };
-    int particle_rate = 20;
-
-    struct phys_col_world phys_col_world;
-
-    struct {
-        const struct system_reg *sys_reg;
-        void *aux_ctx;
-    } systems[] = {
-#if 0
-        { &phys_gravity_sys, NULL },
-#else
-        { &phys_gravity_batch_sys, NULL },
-#endif
-        { &phys_drag_sys, NULL },
-        { &phys_integrate_sys, NULL },
-        { &phys_wall_col_sys, NULL },
-        { &phys_post_col_sys, NULL },
-        { &phys_sphere_col_build_sys, &phys_col_world },
-        { &phys_sphere_col_sys, &phys_col_world },
-    };
+    int particle_rate = 20; /* Per 1/60 s */
+
+    /* Applied at the next tick, after its particles have been created */
+    struct vec3 push_point;
+    int push_pending = 0;
+    double n_pending_particles = 0.0;
+    size_t n_spawned;
+
+    /* Simulation rate and the most ticks run to catch up in a single frame */
+    double sim_dt = PHYS_DEFAULT_DT;
+    unsigned max_substeps = 4;
+    struct timestep timestep;
+    uint64_t frame_start, now;
+    unsigned n_steps, step;
+    uint64_t span_start;
+    struct sys_perf sys_perf;
+    size_t n_ticked = 0;
+
+    struct thread_pool thread_pool;
+    unsigned n_threads = 0; /* One per online CPU */
 
     SDL_Window *win;
     SDL_Renderer *rend;
@@ -331,6 +442,16 @@ int main(void)
     SDL_GLContext sdl_gl_ctx;
     struct render render;
 
+    if (argc > 1)
+        sim_dt = strtod(argv[1], NULL);
+    if (argc > 2)
+        max_substeps = strtoul(argv[2], NULL, 0);
+
+    if (!(sim_dt > 0.0) || !max_substeps) {
+        fprintf(stderr, "Tick dt and tick count have to be positive\n");
+        return EXIT_FAILURE;
+    }
+
     /* TODO Clean these up */
 
     SDL_Init(SDL_INIT_EVERYTHING);
@@ -356,9 +477,7 @@ int main(void)
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    decs_init(&decs);
     ttf_init(rend, win, NULL);
-    phys_col_world_init(&phys_col_world);
     err = render_init(&render);
     if (err) {
         fprintf(stderr, "Render init failed\n");
@@ -366,30 +485,30 @@ int main(void)
         goto out_sdl_tear_down;
     }
 
-    comp_ids.phys_pos = decs_register_comp(&decs, "phys_pos",
-                                           sizeof(struct phys_pos_comp));
-    comp_ids.phys_dyn = decs_register_comp(&decs, "phys_dyn",
-                                           sizeof(struct phys_dyn_comp));
-    comp_ids.color = decs_register_comp(&decs, "color",
-                                        sizeof(struct color_comp));
-    comp_ids.scale = decs_register_comp(&decs, "scale", sizeof(float));
-
-    comp_ids.phys_sphere_col =
-            decs_register_comp(&decs, "phys_sphere_col",
-                               sizeof(struct phys_sphere_comp));
-
-    for (i = 0; i < sizeof(systems) / sizeof(systems[0]); ++i) {
-        err = decs_register_system(&decs, systems[i].sys_reg,
-                                   systems[i].aux_ctx, NULL);
-        if (err < 0) {
-            fprintf(stderr, "Error occurred while registering system \"%s\"\n",
-                    systems[i].sys_reg->name);
-            ret = EXIT_FAILURE;
-            goto out_sdl_tear_down;
-        }
+    err = thread_pool_init(&thread_pool, n_threads);
+    if (err) {
+        fprintf(stderr, "Thread pool init failed\n");
+        ret = EXIT_FAILURE;
+        goto out_render_cleanup;
     }
+    phys_set_thread_pool(&thread_pool);
 
-    decs_tick_dryrun(&decs);
+    err = scene_init(&scene, win_w / (float)win_h);
+    if (err) {
+        ret = EXIT_FAILURE;
+        goto out_thread_pool_cleanup;
+    }
+
+    err = sys_perf_init(&sys_perf, &scene.decs, SYS_PERF_ALL_FIELDS);
+    if (err) {
+        ret = EXIT_FAILURE;
+        goto out_scene_cleanup;
+    }
+
+    trace_set_thread_name("main");
+    scene_set_dt(&scene, sim_dt);
+    timestep_init(&timestep, sim_dt, max_substeps);
+    frame_start = SDL_GetPerformanceCounter();
 
     while (running) {
         while (SDL_PollEvent(&event)) {
@@ -402,9 +521,46 @@ int main(void)
                     spawn_point = normalize_screen_coords(event.button.x,
                                                           event.button.y);
                 } else if (event.button.button == SDL_BUTTON_RIGHT) {
-                    create_pin(&decs, &comp_ids,
-                               normalize_screen_coords(event.button.x,
-                                                       event.button.y));
+                    scene_create_pin(&scene,
+                                     normalize_screen_coords(event.button.x,
+                                                             event.button.y));
+                } else if (event.button.button == SDL_BUTTON_MIDDLE) {
+                    push_point = normalize_screen_coords(event.button.x,
+                                                         event.button.y);
+                    push_pending = 1;
+                }
+                break;
+            case SDL_KEYDOWN:
+                if (event.key.keysym.sym == SDLK_F5) {
+                    if (!snapshot_save(&scene, snapshot_path))
+                        printf("Saved \"%s\"\n", snapshot_path);
+                } else if (event.key.keysym.sym == SDLK_F9) {
+                    if (!snapshot_load(&scene, snapshot_path))
+                        printf("Loaded \"%s\"\n", snapshot_path);
+                } else if (event.key.keysym.sym == SDLK_F2) {
+                    /* Toggles tracing, the trace is written on stopping */
+                    if (!trace_enabled) {
+                        trace_start();
+                        printf("Tracing\n");
+                    } else {
+                        trace_stop();
+                        if (!trace_dump(trace_path))
+                            printf("Saved \"%s\"\n", trace_path);
+                    }
+                } else if (event.key.keysym.sym == SDLK_F3) {
+                    /* Toggles writing the per tick counters */
+                    if (!sys_perf.csv) {
+                        if (!sys_perf_open_csv(&sys_perf, perf_csv_path))
+                            printf("Writing \"%s\"\n", perf_csv_path);
+                    } else {
+                        sys_perf_close_csv(&sys_perf);
+                        printf("Saved \"%s\"\n", perf_csv_path);
+                    }
+                } else if (event.key.keysym.sym == SDLK_F4) {
+                    /* The counters are only sampled with decs_tick() */
+                    scene_set_parallel(&scene, !scene.parallel);
+                    printf("%s tick\n", scene.parallel ? "Parallel" :
+                                                         "decs");
                 }
                 break;
             case SDL_MOUSEWHEEL:
@@ -416,20 +572,71 @@ int main(void)
             }
         }
 
-        for (i = 0; i < particle_rate; ++i)
-            create_particle(&decs, &comp_ids, spawn_point);
+        now = SDL_GetPerformanceCounter();
+        n_steps = timestep_advance(&timestep,
+                                   (now - frame_start) /
+                                   (double)SDL_GetPerformanceFrequency());
+        frame_start = now;
+
+        for (step = 0; step < n_steps; ++step) {
+            /* A negative rate spawns nothing rather than running up a debt */
+            n_pending_particles += particle_rate * 60.0 * sim_dt;
+            if (n_pending_particles < 0.0)
+                n_pending_particles = 0.0;
+            n_spawned = n_pending_particles;
+            scene_create_particles(&scene, spawn_point, n_spawned);
+            n_pending_particles -= n_spawned;
+
+            if (push_pending) {
+                scene_push(&scene, push_point, 0.5f, 2000.0f);
+                push_pending = 0;
+            }
 
-        decs_tick(&decs);
-        phys_col_world_tick(&phys_col_world);
+            if (step + 1 == n_steps)
+                scene_save_prev_pos(&scene);
+            n_ticked = scene.entity_pool.n_live;
+            scene_tick(&scene);
+            if (!scene.parallel)
+                sys_perf_sample(&sys_perf, &scene.decs, n_ticked);
+        }
 
-        render_do(&render, &decs, &comp_ids, sb_size(decs.entity_comp_map));
+        span_start = trace_begin();
+        render_do(&render, &scene.decs, &scene.comp_ids,
+                  scene.entity_pool.n_live, timestep_alpha(&timestep));
+        trace_end("render_do", span_start);
 
-        render_system_perf_stats(&decs);
+        span_start = trace_begin();
+        if (scene.parallel)
+            render_system_sched_stats(&scene.sys_sched, n_ticked);
+        else
+            render_system_perf_stats(&sys_perf, &scene.decs);
+        ttf_flush();
+        trace_end("hud", span_start);
 
+        span_start = trace_begin();
         SDL_GL_SwapWindow(win);
+        trace_end("SDL_GL_SwapWindow", span_start);
+    }
+
+    /* The system names are owned by decs and the scene */
+    if (trace_enabled) {
+        trace_stop();
+        if (!trace_dump(trace_path))
+            printf("Saved \"%s\"\n", trace_path);
     }
 
-    decs_cleanup(&decs);
+    sys_perf_cleanup(&sys_perf);
+
+out_scene_cleanup:
+    scene_cleanup(&scene);
+
+out_thread_pool_cleanup:
+    phys_set_thread_pool(NULL);
+    thread_pool_cleanup(&thread_pool);
+    trace_cleanup();
+
+out_render_cleanup:
+    render_cleanup(&render);
 
 out_sdl_tear_down:
     SDL_GL_DeleteContext(sdl_gl_ctx);
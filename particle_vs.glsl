@@ -1,9 +1,14 @@
 #version 330
 
 layout(location = 0) in vec3 vert_pos;
-layout(location = 1) in vec3 pos_offset;
-layout(location = 2) in vec3 color;
-layout(location = 3) in float scale;
+/* Unsigned normalised, see struct cull_instance */
+layout(location = 1) in vec3 packed_pos;
+layout(location = 2) in vec4 color;
+layout(location = 3) in float packed_scale;
+
+uniform vec3 pos_min;
+uniform vec3 pos_range;
+uniform float max_scale;
 
 flat out vec3 center_pos;
 flat out vec3 particle_color;
@@ -11,8 +16,11 @@ flat out float particle_scale;
 
 void main()
 {
+    vec3 pos_offset = pos_min + packed_pos * pos_range;
+    float scale = packed_scale * max_scale;
+
     center_pos = pos_offset;
-    particle_color = color;
+    particle_color = color.rgb;
     particle_scale = scale;
 
     gl_Position.xyz = (vert_pos * scale + pos_offset);
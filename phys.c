@@ -1,11 +1,20 @@
+#include <math.h>
+
 #include "phys.h"
+#include "phys_kernels.h"
+#include "trace.h"
 
 void phys_drag_tick(struct decs *, uint64_t, void *);
+void phys_drag_batch_tick(struct decs *, uint64_t, uint64_t, void *);
 void phys_gravity_tick(struct decs *, uint64_t, void *);
 void phys_gravity_batch_tick(struct decs *, uint64_t, uint64_t, void *);
 void phys_integrater_tick(struct decs *, uint64_t, void *);
+void phys_integrater_batch_tick(struct decs *, uint64_t, uint64_t, void *);
 void phys_wall_col_tick(struct decs *, uint64_t, void *);
+void phys_wall_col_batch_tick(struct decs *, uint64_t, uint64_t, void *);
 void phys_post_col_tick(struct decs *, uint64_t, void *);
+void phys_post_col_batch_tick(struct decs *, uint64_t, uint64_t, void *);
+void phys_fused_tick(struct decs *, uint64_t, uint64_t, void *);
 
 struct phys_drag_ctx {
     struct phys_dyn_comp *phys_base;
@@ -20,6 +29,25 @@ struct phys_ctx {
     struct phys_dyn_comp *phys_dyn_base;
 };
 
+/* Work of a batch system, handed to the thread pool */
+struct phys_batch_job {
+    struct phys_pos_comp *pos;
+    struct phys_dyn_comp *dyn;
+    float dt;
+    enum phys_integrator integrator;
+};
+
+static struct thread_pool *phys_thread_pool;
+static float phys_dt = PHYS_DEFAULT_DT;
+static enum phys_integrator phys_integrator = PHYS_DEFAULT_INTEGRATOR;
+
+static const char *const phys_integrator_names[PHYS_N_INTEGRATORS] = {
+    [PHYS_INTEGRATOR_EULER]             = "euler",
+    [PHYS_INTEGRATOR_SYMPLECTIC_EULER]  = "symplectic_euler",
+    [PHYS_INTEGRATOR_VERLET]            = "verlet",
+    [PHYS_INTEGRATOR_RK4]               = "rk4",
+};
+
 const struct system_reg phys_drag_sys = {
     .name       = "phys_drag",
     .comps      = STR_ARR("phys_dyn"),
@@ -27,6 +55,14 @@ const struct system_reg phys_drag_sys = {
     .post_deps  = STR_ARR("phys_integrate"),
 };
 
+const struct system_reg phys_drag_batch_sys = {
+    .name       = "phys_drag",
+    .comps      = STR_ARR("phys_dyn"),
+    .func       = phys_drag_batch_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+    .post_deps  = STR_ARR("phys_integrate"),
+};
+
 const struct system_reg phys_gravity_sys = {
     .name       = "phys_gravity",
     .comps      = STR_ARR("phys_dyn"),
@@ -48,6 +84,13 @@ const struct system_reg phys_integrate_sys = {
     .func       = phys_integrater_tick,
 };
 
+const struct system_reg phys_integrate_batch_sys = {
+    .name       = "phys_integrate",
+    .comps      = STR_ARR("phys_pos", "phys_dyn"),
+    .func       = phys_integrater_batch_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+};
+
 const struct system_reg phys_wall_col_sys = {
     .name       = "phys_wall_col",
     .comps      = STR_ARR("phys_pos", "phys_dyn"),
@@ -55,6 +98,14 @@ const struct system_reg phys_wall_col_sys = {
     .pre_deps   = STR_ARR("phys_integrate"),
 };
 
+const struct system_reg phys_wall_col_batch_sys = {
+    .name       = "phys_wall_col",
+    .comps      = STR_ARR("phys_pos", "phys_dyn"),
+    .func       = phys_wall_col_batch_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+    .pre_deps   = STR_ARR("phys_integrate"),
+};
+
 const struct system_reg phys_post_col_sys = {
     .name       = "phys_post_col",
     .comps      = STR_ARR("phys_pos", "phys_dyn"),
@@ -62,26 +113,55 @@ const struct system_reg phys_post_col_sys = {
     .pre_deps   = STR_ARR("phys_wall_col"),
 };
 
+const struct system_reg phys_post_col_batch_sys = {
+    .name       = "phys_post_col",
+    .comps      = STR_ARR("phys_pos", "phys_dyn"),
+    .func       = phys_post_col_batch_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+    .pre_deps   = STR_ARR("phys_wall_col"),
+};
+
+/*
+ * Gravity, drag, integration, wall collisions and the position update in a
+ * single pass, registered in place of the five systems above
+ */
+const struct system_reg phys_fused_sys = {
+    .name       = "phys_fused",
+    .comps      = STR_ARR("phys_pos", "phys_dyn"),
+    .func       = phys_fused_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+};
+
 void phys_drag_tick(struct decs *decs, uint64_t eid, void *func_data)
 {
     struct phys_drag_ctx *ctx = func_data;
     struct phys_dyn_comp *phys = ctx->phys_base + eid;
-
-
-#if 1
-    const float fluid_density = 1.2f; /* Air */
-#else
-    const float fluid_density = 999.9f; /* Water */
-#endif
-    const float area = 10.10f;
-    const float drag_coef = 0.47f; // Sphere
-    const float total_drag_coef = -0.5f * fluid_density * drag_coef * area;
     const struct vec3 vel2 = vec3_spow2(phys->vel);
-    struct vec3 drag_force = vec3_muls(vel2, total_drag_coef);
+    struct vec3 drag_force = vec3_muls(vel2, PHYS_TOTAL_DRAG_COEF);
 
     phys->force = vec3_add(phys->force, drag_force);
 }
 
+static void phys_drag_batch_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_batch_job *job = data;
+
+    phys_kernels()->drag(job->dyn + first, n);
+}
+
+void phys_drag_batch_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                          void *func_data)
+{
+    struct phys_drag_ctx *ctx = func_data;
+    struct phys_batch_job job = { .dyn = ctx->phys_base + eid };
+    uint64_t span_start = trace_begin();
+
+    thread_pool_run(phys_thread_pool, phys_drag_batch_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_drag", span_start);
+}
+
 void phys_gravity_tick(struct decs *decs, uint64_t eid, void *func_data)
 {
     struct phys_gravity_ctx *ctx = func_data;
@@ -90,11 +170,9 @@ void phys_gravity_tick(struct decs *decs, uint64_t eid, void *func_data)
     phys->force.y -= 9.81f;
 }
 
-void phys_gravity_batch_tick(struct decs *decs, uint64_t eid, uint64_t n,
-                             void *func_data)
+static void phys_gravity_batch_chunk(void *data, size_t first, size_t n)
 {
-    struct phys_gravity_ctx *ctx = func_data;
-    struct phys_dyn_comp *phys = ctx->phys_base + eid;
+    struct phys_dyn_comp *phys = (struct phys_dyn_comp *)data + first;
 
     while (n--) {
         phys->force.y -= 9.81f;
@@ -102,15 +180,78 @@ void phys_gravity_batch_tick(struct decs *decs, uint64_t eid, uint64_t n,
     }
 }
 
-static void phys_euler_tick(struct phys_dyn_comp *phys, struct vec3 force,
-                            float dt)
+void phys_gravity_batch_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                             void *func_data)
 {
-    struct vec3 acc = vec3_muls(force, 1.0f / phys->mass);
+    struct phys_gravity_ctx *ctx = func_data;
+    uint64_t span_start = trace_begin();
 
-    struct vec3 d_vel = vec3_muls(acc, dt);
+    thread_pool_run(phys_thread_pool, phys_gravity_batch_chunk,
+                    ctx->phys_base + eid, n, PHYS_BATCH_CHUNK_SIZE);
 
-    phys->vel = vec3_add(phys->vel, d_vel);
-    phys->d_pos = vec3_muls(phys->vel, dt);
+    trace_end("phys_gravity", span_start);
+}
+
+static inline struct vec3 phys_drag_force(struct vec3 vel)
+{
+    const float k = PHYS_TOTAL_DRAG_COEF;
+
+    return (struct vec3) {
+        vel.x * fabsf(vel.x) * k,
+        vel.y * fabsf(vel.y) * k,
+        vel.z * fabsf(vel.z) * k,
+    };
+}
+
+/* Acceleration at vel, ext being the force apart from the drag */
+static inline struct vec3 phys_acc(struct vec3 ext, struct vec3 vel,
+                                   float inv_mass)
+{
+    return vec3_muls(vec3_add(ext, phys_drag_force(vel)), inv_mass);
+}
+
+void phys_integrate(struct vec3 *vel, struct vec3 *d_pos, struct vec3 force,
+                    float mass, float dt, enum phys_integrator integrator)
+{
+    const float inv_mass = 1.0f / mass;
+    const struct vec3 v0 = *vel;
+    const struct vec3 a0 = vec3_muls(force, inv_mass);
+    struct vec3 ext, v1, v2, v3, a1, a2, a3;
+
+    switch (integrator) {
+    case PHYS_INTEGRATOR_EULER:
+        *d_pos = vec3_muls(v0, dt);
+        *vel = vec3_add(v0, vec3_muls(a0, dt));
+        break;
+    default:
+    case PHYS_INTEGRATOR_SYMPLECTIC_EULER:
+        *vel = vec3_add(v0, vec3_muls(a0, dt));
+        *d_pos = vec3_muls(*vel, dt);
+        break;
+    case PHYS_INTEGRATOR_VERLET:
+        /* The drag at the end of the step is taken at the predicted vel */
+        ext = vec3_sub(force, phys_drag_force(v0));
+        *d_pos = vec3_add(vec3_muls(v0, dt), vec3_muls(a0, 0.5f * dt * dt));
+        a1 = phys_acc(ext, vec3_add(v0, vec3_muls(a0, dt)), inv_mass);
+        *vel = vec3_add(v0, vec3_muls(vec3_add(a0, a1), 0.5f * dt));
+        break;
+    case PHYS_INTEGRATOR_RK4:
+        ext = vec3_sub(force, phys_drag_force(v0));
+        v1 = vec3_add(v0, vec3_muls(a0, 0.5f * dt));
+        a1 = phys_acc(ext, v1, inv_mass);
+        v2 = vec3_add(v0, vec3_muls(a1, 0.5f * dt));
+        a2 = phys_acc(ext, v2, inv_mass);
+        v3 = vec3_add(v0, vec3_muls(a2, dt));
+        a3 = phys_acc(ext, v3, inv_mass);
+        *d_pos = vec3_muls(vec3_add(vec3_add(v0, v3),
+                                    vec3_muls(vec3_add(v1, v2), 2.0f)),
+                           dt / 6.0f);
+        *vel = vec3_add(v0, vec3_muls(vec3_add(vec3_add(a0, a3),
+                                               vec3_muls(vec3_add(a1, a2),
+                                                         2.0f)),
+                                      dt / 6.0f));
+        break;
+    }
 }
 
 void phys_integrater_tick(struct decs *decs, uint64_t eid, void *func_data)
@@ -118,13 +259,49 @@ void phys_integrater_tick(struct decs *decs, uint64_t eid, void *func_data)
     struct phys_ctx *phys_ctx = func_data;
     struct phys_dyn_comp *phys_dyn = phys_ctx->phys_dyn_base + eid;
 
-    float dt = 1.0f / 60.0f;
+    float dt = phys_dt;
 
-    phys_euler_tick(phys_dyn, phys_dyn->force, dt);
+    phys_integrate(&phys_dyn->vel, &phys_dyn->d_pos, phys_dyn->force,
+                   phys_dyn->mass, dt, phys_integrator);
 
     phys_dyn->force = (struct vec3){ 0.0f, 0.0f, 0.0f };
 }
 
+static void phys_integrater_batch_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_batch_job *job = data;
+    struct phys_dyn_comp *dyn = job->dyn + first;
+
+    /* Only the default scheme has SIMD kernels */
+    if (job->integrator == PHYS_INTEGRATOR_SYMPLECTIC_EULER) {
+        phys_kernels()->integrate(dyn, n, job->dt);
+        return;
+    }
+
+    for (; n--; ++dyn) {
+        phys_integrate(&dyn->vel, &dyn->d_pos, dyn->force, dyn->mass,
+                       job->dt, job->integrator);
+        dyn->force = (struct vec3){ 0.0f, 0.0f, 0.0f };
+    }
+}
+
+void phys_integrater_batch_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                                void *func_data)
+{
+    struct phys_ctx *phys_ctx = func_data;
+    struct phys_batch_job job = {
+        .dyn = phys_ctx->phys_dyn_base + eid,
+        .dt = phys_dt,
+        .integrator = phys_integrator,
+    };
+    uint64_t span_start = trace_begin();
+
+    thread_pool_run(phys_thread_pool, phys_integrater_batch_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_integrate", span_start);
+}
+
 void phys_wall_col_tick(struct decs *decs, uint64_t eid, void *func_data)
 {
     struct phys_ctx *phys_ctx = func_data;
@@ -145,6 +322,30 @@ void phys_wall_col_tick(struct decs *decs, uint64_t eid, void *func_data)
 #endif
 }
 
+static void phys_wall_col_batch_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_batch_job *job = data;
+
+    phys_kernels()->wall_col(job->pos + first, job->dyn + first, n);
+}
+
+/* Branchless, the bounce is applied through a mask of the colliding lanes */
+void phys_wall_col_batch_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                              void *func_data)
+{
+    struct phys_ctx *phys_ctx = func_data;
+    struct phys_batch_job job = {
+        .pos = phys_ctx->phys_pos_base + eid,
+        .dyn = phys_ctx->phys_dyn_base + eid,
+    };
+    uint64_t span_start = trace_begin();
+
+    thread_pool_run(phys_thread_pool, phys_wall_col_batch_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_wall_col", span_start);
+}
+
 void phys_post_col_tick(struct decs *decs, uint64_t eid, void *func_data)
 {
     struct phys_ctx *phys_ctx = func_data;
@@ -154,3 +355,140 @@ void phys_post_col_tick(struct decs *decs, uint64_t eid, void *func_data)
     phys_pos->pos = vec3_add(phys_pos->pos, phys_dyn->d_pos);
 }
 
+static void phys_post_col_batch_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_batch_job *job = data;
+
+    phys_kernels()->post_col(job->pos + first, job->dyn + first, n);
+}
+
+void phys_post_col_batch_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                              void *func_data)
+{
+    struct phys_ctx *phys_ctx = func_data;
+    struct phys_batch_job job = {
+        .pos = phys_ctx->phys_pos_base + eid,
+        .dyn = phys_ctx->phys_dyn_base + eid,
+    };
+    uint64_t span_start = trace_begin();
+
+    thread_pool_run(phys_thread_pool, phys_post_col_batch_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_post_col", span_start);
+}
+
+/*
+ * Same operations in the same order as the separate systems, so the results
+ * match theirs, only the force never leaves the registers.
+ */
+static inline void phys_fused_one(struct phys_pos_comp *pos,
+                                  struct phys_dyn_comp *dyn, float dt,
+                                  enum phys_integrator integrator)
+{
+    const float k = PHYS_TOTAL_DRAG_COEF;
+    struct vec3 p = pos->pos;
+    struct vec3 v = dyn->vel;
+    struct vec3 f = dyn->force;
+    struct vec3 d;
+    float hit;
+
+    f.y -= 9.81f;
+
+    f.x += v.x * fabsf(v.x) * k;
+    f.y += v.y * fabsf(v.y) * k;
+    f.z += v.z * fabsf(v.z) * k;
+
+    if (integrator == PHYS_INTEGRATOR_SYMPLECTIC_EULER) {
+        v = vec3_add(v, vec3_muls(vec3_muls(f, 1.0f / dyn->mass), dt));
+        d = vec3_muls(v, dt);
+    } else {
+        phys_integrate(&v, &d, f, dyn->mass, dt, integrator);
+    }
+
+    hit = fabsf(p.y + d.y) > 1.0f;
+    v.y *= 1.0f + (PHYS_WALL_BOUNCE - 1.0f) * hit;
+    p.y *= 1.0f - PHYS_WALL_EPSILON * hit;
+
+    pos->pos = vec3_add(p, d);
+    dyn->d_pos = d;
+    dyn->vel = v;
+    dyn->force = (struct vec3){ 0.0f, 0.0f, 0.0f };
+}
+
+static void phys_fused_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_batch_job *job = data;
+    struct phys_pos_comp *pos = job->pos + first;
+    struct phys_dyn_comp *dyn = job->dyn + first;
+
+    for (; n--; ++pos, ++dyn)
+        phys_fused_one(pos, dyn, job->dt, job->integrator);
+}
+
+void phys_fused_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                     void *func_data)
+{
+    struct phys_ctx *phys_ctx = func_data;
+    struct phys_batch_job job = {
+        .pos = phys_ctx->phys_pos_base + eid,
+        .dyn = phys_ctx->phys_dyn_base + eid,
+        .dt = phys_dt,
+        .integrator = phys_integrator,
+    };
+    uint64_t span_start = trace_begin();
+
+    thread_pool_run(phys_thread_pool, phys_fused_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_fused", span_start);
+}
+
+void phys_set_thread_pool(struct thread_pool *pool)
+{
+    phys_thread_pool = pool;
+}
+
+struct thread_pool *phys_get_thread_pool(void)
+{
+    return phys_thread_pool;
+}
+
+void phys_set_dt(float dt)
+{
+    phys_dt = dt;
+}
+
+float phys_get_dt(void)
+{
+    return phys_dt;
+}
+
+void phys_set_integrator(enum phys_integrator integrator)
+{
+    phys_integrator = integrator;
+}
+
+enum phys_integrator phys_get_integrator(void)
+{
+    return phys_integrator;
+}
+
+const char *phys_integrator_name(enum phys_integrator integrator)
+{
+    if (integrator >= PHYS_N_INTEGRATORS)
+        return "unknown";
+
+    return phys_integrator_names[integrator];
+}
+
+void phys_pos_lerp(struct phys_pos_comp *dst, const struct phys_pos_comp *prev,
+                   const struct phys_pos_comp *cur, size_t n, float alpha)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        dst[i].pos = vec3_add(prev[i].pos,
+                              vec3_muls(vec3_sub(cur[i].pos, prev[i].pos),
+                                        alpha));
+}
@@ -3,6 +3,28 @@
 
 #include "vec3.h"
 #include "decs.h"
+#include "thread_pool.h"
+
+/* Entities per work item when a batch system is split across threads */
+#define PHYS_BATCH_CHUNK_SIZE 4096
+
+#define PHYS_DEFAULT_DT (1.0f / 60.0f)
+
+/*
+ * Integration schemes of the phys_integrate and phys_fused systems. The
+ * higher order ones evaluate the drag again at their intermediate
+ * velocities, the rest of the accumulated force is held constant over the
+ * step.
+ */
+enum phys_integrator {
+    PHYS_INTEGRATOR_EULER,              /* Moves by the old velocity */
+    PHYS_INTEGRATOR_SYMPLECTIC_EULER,   /* Moves by the new velocity */
+    PHYS_INTEGRATOR_VERLET,             /* Velocity Verlet */
+    PHYS_INTEGRATOR_RK4,
+    PHYS_N_INTEGRATORS,
+};
+
+#define PHYS_DEFAULT_INTEGRATOR PHYS_INTEGRATOR_SYMPLECTIC_EULER
 
 struct phys_pos_comp {
     struct vec3 pos;
@@ -16,10 +38,42 @@ struct phys_dyn_comp  {
 };
 
 const struct system_reg phys_drag_sys;
+const struct system_reg phys_drag_batch_sys;
 const struct system_reg phys_gravity_sys;
 const struct system_reg phys_gravity_batch_sys;
 const struct system_reg phys_integrate_sys;
+const struct system_reg phys_integrate_batch_sys;
 const struct system_reg phys_wall_col_sys;
+const struct system_reg phys_wall_col_batch_sys;
 const struct system_reg phys_post_col_sys;
+const struct system_reg phys_post_col_batch_sys;
+const struct system_reg phys_fused_sys;
+
+/*
+ * Batch systems split their entity ranges across the given pool, NULL (the
+ * default) runs them on the thread calling decs_tick.
+ */
+void phys_set_thread_pool(struct thread_pool *pool);
+struct thread_pool *phys_get_thread_pool(void);
+
+/* Time step of the integrating systems, in seconds */
+void phys_set_dt(float dt);
+float phys_get_dt(void);
+
+/* Scheme of the integrating systems, PHYS_DEFAULT_INTEGRATOR by default */
+void phys_set_integrator(enum phys_integrator integrator);
+enum phys_integrator phys_get_integrator(void);
+const char *phys_integrator_name(enum phys_integrator integrator);
+
+/*
+ * Advances vel by dt and stores the displacement over the step in d_pos.
+ * force is the total force at vel, including the drag at vel.
+ */
+void phys_integrate(struct vec3 *vel, struct vec3 *d_pos, struct vec3 force,
+                    float mass, float dt, enum phys_integrator integrator);
+
+/* dst = prev + (cur - prev) * alpha, for rendering between two ticks */
+void phys_pos_lerp(struct phys_pos_comp *dst, const struct phys_pos_comp *prev,
+                   const struct phys_pos_comp *cur, size_t n, float alpha);
 
 #endif
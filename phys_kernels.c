@@ -0,0 +1,359 @@
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PHYS_KERNELS_X86
+#endif
+
+#include "phys_kernels.h"
+
+/*
+ * The SIMD variants rely on the layout of the components. A 16 byte load at
+ * &phys_dyn_comp.vel gets vel and force.x, one at &phys_dyn_comp.force gets
+ * force and mass, so a vec3 of a single entity fits a register with the
+ * fourth lane carrying the neighbouring field, which must be written back
+ * unchanged. phys_pos_comp is only 12 bytes, so a 16 byte access at pos[i]
+ * spills into pos[i + 1].pos.x and the last entity of a run is always done
+ * with scalar code; the runs are chunks which may be processed concurrently.
+ */
+
+static void phys_drag_scalar(struct phys_dyn_comp *dyn, size_t n)
+{
+    const float k = PHYS_TOTAL_DRAG_COEF;
+
+    for (; n--; ++dyn) {
+        dyn->force.x += dyn->vel.x * fabsf(dyn->vel.x) * k;
+        dyn->force.y += dyn->vel.y * fabsf(dyn->vel.y) * k;
+        dyn->force.z += dyn->vel.z * fabsf(dyn->vel.z) * k;
+    }
+}
+
+static inline void phys_integrate_one(struct phys_dyn_comp *dyn, float dt)
+{
+    struct vec3 acc = vec3_muls(dyn->force, 1.0f / dyn->mass);
+
+    dyn->vel = vec3_add(dyn->vel, vec3_muls(acc, dt));
+    dyn->d_pos = vec3_muls(dyn->vel, dt);
+    dyn->force = (struct vec3){ 0.0f, 0.0f, 0.0f };
+}
+
+static void phys_integrate_scalar(struct phys_dyn_comp *dyn, size_t n,
+                                  float dt)
+{
+    for (; n--; ++dyn)
+        phys_integrate_one(dyn, dt);
+}
+
+static void phys_wall_col_scalar(struct phys_pos_comp *pos,
+                                 struct phys_dyn_comp *dyn, size_t n)
+{
+    float y;
+    float hit;
+
+    for (; n--; ++pos, ++dyn) {
+        y = pos->pos.y + dyn->d_pos.y;
+        hit = fabsf(y) > 1.0f;
+        dyn->vel.y *= 1.0f + (PHYS_WALL_BOUNCE - 1.0f) * hit;
+        pos->pos.y *= 1.0f - PHYS_WALL_EPSILON * hit;
+    }
+}
+
+static inline void phys_post_col_one(struct phys_pos_comp *pos,
+                                     const struct phys_dyn_comp *dyn)
+{
+    pos->pos = vec3_add(pos->pos, dyn->d_pos);
+}
+
+static void phys_post_col_scalar(struct phys_pos_comp *pos,
+                                 const struct phys_dyn_comp *dyn, size_t n)
+{
+    for (; n--; ++pos, ++dyn)
+        phys_post_col_one(pos, dyn);
+}
+
+static const struct phys_kernels phys_kernels_scalar = {
+    .name       = "scalar",
+    .drag       = phys_drag_scalar,
+    .integrate  = phys_integrate_scalar,
+    .wall_col   = phys_wall_col_scalar,
+    .post_col   = phys_post_col_scalar,
+};
+
+#ifdef PHYS_KERNELS_X86
+
+static inline __m128 phys_sse_xyz_mask(void)
+{
+    return _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+}
+
+static inline __m128 phys_sse_abs_mask(void)
+{
+    return _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+}
+
+static inline __m128 phys_sse_select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static void phys_drag_sse(struct phys_dyn_comp *dyn, size_t n)
+{
+    const __m128 k = _mm_set1_ps(PHYS_TOTAL_DRAG_COEF);
+    const __m128 xyz = phys_sse_xyz_mask();
+    const __m128 abs_mask = phys_sse_abs_mask();
+    __m128 v, f, d;
+
+    for (; n--; ++dyn) {
+        v = _mm_loadu_ps(&dyn->vel.x);
+        f = _mm_loadu_ps(&dyn->force.x);
+        d = _mm_mul_ps(_mm_mul_ps(v, _mm_and_ps(v, abs_mask)), k);
+        _mm_storeu_ps(&dyn->force.x, _mm_add_ps(f, _mm_and_ps(d, xyz)));
+    }
+}
+
+static void phys_integrate_sse(struct phys_dyn_comp *dyn, size_t n, float dt)
+{
+    const __m128 dt4 = _mm_set1_ps(dt);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 xyz = phys_sse_xyz_mask();
+    __m128 f, m, v, d;
+
+    for (; n--; ++dyn) {
+        f = _mm_loadu_ps(&dyn->force.x);
+        m = _mm_shuffle_ps(f, f, _MM_SHUFFLE(3, 3, 3, 3));
+        v = _mm_loadu_ps(&dyn->vel.x);
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_mul_ps(f, _mm_div_ps(one, m)), dt4));
+        d = _mm_mul_ps(v, dt4);
+
+        /* d_pos and vel.x, vel and a cleared force.x, cleared force and mass */
+        _mm_storeu_ps(&dyn->d_pos.x,
+                      phys_sse_select(xyz, d, _mm_shuffle_ps(v, v, 0)));
+        _mm_storeu_ps(&dyn->vel.x, _mm_and_ps(v, xyz));
+        _mm_storeu_ps(&dyn->force.x, _mm_andnot_ps(xyz, f));
+    }
+}
+
+static void phys_wall_col_sse(struct phys_pos_comp *pos,
+                              struct phys_dyn_comp *dyn, size_t n)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 bounce = _mm_set1_ps(PHYS_WALL_BOUNCE);
+    const __m128 shrink = _mm_set1_ps(1.0f - PHYS_WALL_EPSILON);
+    const __m128 abs_mask = phys_sse_abs_mask();
+    float vel_y[4], pos_y[4];
+    __m128 py, vy, hit;
+    size_t i, j;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        py = _mm_setr_ps(pos[i].pos.y, pos[i + 1].pos.y,
+                         pos[i + 2].pos.y, pos[i + 3].pos.y);
+        vy = _mm_setr_ps(dyn[i].vel.y, dyn[i + 1].vel.y,
+                         dyn[i + 2].vel.y, dyn[i + 3].vel.y);
+        hit = _mm_setr_ps(dyn[i].d_pos.y, dyn[i + 1].d_pos.y,
+                          dyn[i + 2].d_pos.y, dyn[i + 3].d_pos.y);
+        hit = _mm_cmpgt_ps(_mm_and_ps(_mm_add_ps(py, hit), abs_mask), one);
+
+        vy = _mm_mul_ps(vy, phys_sse_select(hit, bounce, one));
+        py = _mm_mul_ps(py, phys_sse_select(hit, shrink, one));
+
+        _mm_storeu_ps(vel_y, vy);
+        _mm_storeu_ps(pos_y, py);
+        for (j = 0; j < 4; ++j) {
+            dyn[i + j].vel.y = vel_y[j];
+            pos[i + j].pos.y = pos_y[j];
+        }
+    }
+
+    phys_wall_col_scalar(pos + i, dyn + i, n - i);
+}
+
+static void phys_post_col_sse(struct phys_pos_comp *pos,
+                              const struct phys_dyn_comp *dyn, size_t n)
+{
+    const __m128 xyz = phys_sse_xyz_mask();
+    __m128 p, d;
+
+    if (!n)
+        return;
+
+    for (; --n; ++pos, ++dyn) {
+        p = _mm_loadu_ps(&pos->pos.x);
+        d = _mm_and_ps(_mm_loadu_ps(&dyn->d_pos.x), xyz);
+        _mm_storeu_ps(&pos->pos.x, _mm_add_ps(p, d));
+    }
+
+    phys_post_col_one(pos, dyn);
+}
+
+static const struct phys_kernels phys_kernels_sse = {
+    .name       = "sse",
+    .drag       = phys_drag_sse,
+    .integrate  = phys_integrate_sse,
+    .wall_col   = phys_wall_col_sse,
+    .post_col   = phys_post_col_sse,
+};
+
+/*
+ * The AVX variants process two entities per register, one in each 128 bit
+ * half, except for the wall collision which gathers eight y coordinates.
+ */
+
+#define PHYS_AVX __attribute__((target("avx")))
+
+static inline PHYS_AVX __m256 phys_avx_load2(const float *lo, const float *hi)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)),
+                                _mm_loadu_ps(hi), 1);
+}
+
+static inline PHYS_AVX void phys_avx_store2(float *lo, float *hi, __m256 v)
+{
+    _mm_storeu_ps(lo, _mm256_castps256_ps128(v));
+    _mm_storeu_ps(hi, _mm256_extractf128_ps(v, 1));
+}
+
+static inline PHYS_AVX __m256 phys_avx_xyz_mask(void)
+{
+    return _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1, -1, 0,
+                                                 -1, -1, -1, 0));
+}
+
+static PHYS_AVX void phys_drag_avx(struct phys_dyn_comp *dyn, size_t n)
+{
+    const __m256 k = _mm256_set1_ps(PHYS_TOTAL_DRAG_COEF);
+    const __m256 xyz = phys_avx_xyz_mask();
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 v, f, d;
+
+    for (; n >= 2; n -= 2, dyn += 2) {
+        v = phys_avx_load2(&dyn[0].vel.x, &dyn[1].vel.x);
+        f = phys_avx_load2(&dyn[0].force.x, &dyn[1].force.x);
+        d = _mm256_mul_ps(_mm256_mul_ps(v, _mm256_and_ps(v, abs_mask)), k);
+        f = _mm256_add_ps(f, _mm256_and_ps(d, xyz));
+        phys_avx_store2(&dyn[0].force.x, &dyn[1].force.x, f);
+    }
+
+    phys_drag_sse(dyn, n);
+}
+
+static PHYS_AVX void phys_integrate_avx(struct phys_dyn_comp *dyn, size_t n,
+                                        float dt)
+{
+    const __m256 dt8 = _mm256_set1_ps(dt);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 xyz = phys_avx_xyz_mask();
+    __m256 f, m, v, d;
+
+    for (; n >= 2; n -= 2, dyn += 2) {
+        f = phys_avx_load2(&dyn[0].force.x, &dyn[1].force.x);
+        m = _mm256_permute_ps(f, _MM_SHUFFLE(3, 3, 3, 3));
+        v = phys_avx_load2(&dyn[0].vel.x, &dyn[1].vel.x);
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(f,
+                                                         _mm256_div_ps(one, m)),
+                                           dt8));
+        d = _mm256_mul_ps(v, dt8);
+
+        phys_avx_store2(&dyn[0].d_pos.x, &dyn[1].d_pos.x,
+                        _mm256_blendv_ps(_mm256_permute_ps(v, 0), d, xyz));
+        phys_avx_store2(&dyn[0].vel.x, &dyn[1].vel.x, _mm256_and_ps(v, xyz));
+        phys_avx_store2(&dyn[0].force.x, &dyn[1].force.x,
+                        _mm256_andnot_ps(xyz, f));
+    }
+
+    phys_integrate_sse(dyn, n, dt);
+}
+
+static PHYS_AVX void phys_wall_col_avx(struct phys_pos_comp *pos,
+                                       struct phys_dyn_comp *dyn, size_t n)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 bounce = _mm256_set1_ps(PHYS_WALL_BOUNCE);
+    const __m256 shrink = _mm256_set1_ps(1.0f - PHYS_WALL_EPSILON);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    float vel_y[8], pos_y[8];
+    __m256 py, vy, hit;
+    size_t i, j;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        py = _mm256_setr_ps(pos[i].pos.y, pos[i + 1].pos.y,
+                            pos[i + 2].pos.y, pos[i + 3].pos.y,
+                            pos[i + 4].pos.y, pos[i + 5].pos.y,
+                            pos[i + 6].pos.y, pos[i + 7].pos.y);
+        vy = _mm256_setr_ps(dyn[i].vel.y, dyn[i + 1].vel.y,
+                            dyn[i + 2].vel.y, dyn[i + 3].vel.y,
+                            dyn[i + 4].vel.y, dyn[i + 5].vel.y,
+                            dyn[i + 6].vel.y, dyn[i + 7].vel.y);
+        hit = _mm256_setr_ps(dyn[i].d_pos.y, dyn[i + 1].d_pos.y,
+                             dyn[i + 2].d_pos.y, dyn[i + 3].d_pos.y,
+                             dyn[i + 4].d_pos.y, dyn[i + 5].d_pos.y,
+                             dyn[i + 6].d_pos.y, dyn[i + 7].d_pos.y);
+        hit = _mm256_cmp_ps(_mm256_and_ps(_mm256_add_ps(py, hit), abs_mask),
+                            one, _CMP_GT_OQ);
+
+        vy = _mm256_mul_ps(vy, _mm256_blendv_ps(one, bounce, hit));
+        py = _mm256_mul_ps(py, _mm256_blendv_ps(one, shrink, hit));
+
+        _mm256_storeu_ps(vel_y, vy);
+        _mm256_storeu_ps(pos_y, py);
+        for (j = 0; j < 8; ++j) {
+            dyn[i + j].vel.y = vel_y[j];
+            pos[i + j].pos.y = pos_y[j];
+        }
+    }
+
+    phys_wall_col_sse(pos + i, dyn + i, n - i);
+}
+
+static PHYS_AVX void phys_post_col_avx(struct phys_pos_comp *pos,
+                                       const struct phys_dyn_comp *dyn,
+                                       size_t n)
+{
+    const __m256 xyz = phys_avx_xyz_mask();
+    __m256 p, d;
+
+    /* The second entity of a pair spills into the next one, see above */
+    for (; n > 2; n -= 2, pos += 2, dyn += 2) {
+        p = phys_avx_load2(&pos[0].pos.x, &pos[1].pos.x);
+        d = phys_avx_load2(&dyn[0].d_pos.x, &dyn[1].d_pos.x);
+        p = _mm256_add_ps(p, _mm256_and_ps(d, xyz));
+        phys_avx_store2(&pos[0].pos.x, &pos[1].pos.x, p);
+    }
+
+    phys_post_col_sse(pos, dyn, n);
+}
+
+static const struct phys_kernels phys_kernels_avx = {
+    .name       = "avx",
+    .drag       = phys_drag_avx,
+    .integrate  = phys_integrate_avx,
+    .wall_col   = phys_wall_col_avx,
+    .post_col   = phys_post_col_avx,
+};
+
+#endif /* PHYS_KERNELS_X86 */
+
+static pthread_once_t phys_kernels_once = PTHREAD_ONCE_INIT;
+static const struct phys_kernels *kernels;
+
+static void phys_kernels_select(void)
+{
+#ifdef PHYS_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+        kernels = &phys_kernels_avx;
+    else if (__builtin_cpu_supports("sse2"))
+        kernels = &phys_kernels_sse;
+    else
+        kernels = &phys_kernels_scalar;
+#else
+    kernels = &phys_kernels_scalar;
+#endif
+}
+
+const struct phys_kernels *phys_kernels(void)
+{
+    pthread_once(&phys_kernels_once, phys_kernels_select);
+
+    return kernels;
+}
@@ -0,0 +1,39 @@
+#ifndef PHYS_KERNELS_H
+#define PHYS_KERNELS_H
+
+#include <stddef.h>
+
+#include "phys.h"
+
+#if 1
+#define PHYS_FLUID_DENSITY 1.2f /* Air */
+#else
+#define PHYS_FLUID_DENSITY 999.9f /* Water */
+#endif
+#define PHYS_DRAG_AREA 10.10f
+#define PHYS_DRAG_COEF 0.47f /* Sphere */
+#define PHYS_TOTAL_DRAG_COEF \
+        (-0.5f * PHYS_FLUID_DENSITY * PHYS_DRAG_COEF * PHYS_DRAG_AREA)
+
+#define PHYS_WALL_BOUNCE -0.9f
+#define PHYS_WALL_EPSILON 0.005f
+
+/*
+ * Inner loops of the batch systems, each one processes n consecutive
+ * entities. There's a variant of each for every instruction set level, the
+ * best one supported by the CPU is picked once, by whichever thread calls
+ * phys_kernels() first.
+ */
+struct phys_kernels {
+    const char *name;
+    void (*drag)(struct phys_dyn_comp *dyn, size_t n);
+    void (*integrate)(struct phys_dyn_comp *dyn, size_t n, float dt);
+    void (*wall_col)(struct phys_pos_comp *pos, struct phys_dyn_comp *dyn,
+                     size_t n);
+    void (*post_col)(struct phys_pos_comp *pos,
+                     const struct phys_dyn_comp *dyn, size_t n);
+};
+
+const struct phys_kernels *phys_kernels(void);
+
+#endif
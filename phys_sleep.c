@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "phys_sleep.h"
+
+static void phys_sleep_tick_one(struct decs *decs, uint64_t eid,
+                                void *func_data);
+static void phys_sleep_soa_tick_one(struct decs *decs, uint64_t eid,
+                                    void *func_data);
+
+struct phys_sleep_sys_ctx {
+    struct phys_sleep_ctx *phys_sleep_ctx; /* AUX */
+    struct phys_dyn_comp *phys_dyn_base;
+    struct phys_sleep_comp *phys_sleep_base;
+};
+
+struct phys_sleep_soa_sys_ctx {
+    struct phys_sleep_ctx *phys_sleep_ctx; /* AUX */
+    float *vel[3];
+    float *mass;
+    struct phys_sleep_comp *phys_sleep_base;
+};
+
+/* Runs after the collisions, which are the last to change the velocities */
+const struct system_reg phys_sleep_sys = {
+    .name       = "phys_sleep",
+    .comps      = STR_ARR("phys_dyn", "phys_sleep"),
+    .func       = phys_sleep_tick_one,
+    .pre_deps   = STR_ARR("phys_sphere_col"),
+};
+
+const struct system_reg phys_sleep_soa_sys = {
+    .name       = "phys_sleep",
+    .comps      = STR_ARR("phys_vel_x", "phys_vel_y", "phys_vel_z",
+                          "phys_mass", "phys_sleep"),
+    .func       = phys_sleep_soa_tick_one,
+    .pre_deps   = STR_ARR("phys_sphere_col"),
+};
+
+static void phys_sleep_queue(uint64_t **eids, size_t *n, size_t *n_allocd,
+                             uint64_t eid)
+{
+    if (*n + 1 >= *n_allocd) {
+        if (!*n_allocd)
+            *n_allocd = 1;
+        *n_allocd *= 2;
+        *eids = realloc(*eids, sizeof(**eids) * *n_allocd);
+    }
+
+    (*eids)[(*n)++] = eid;
+}
+
+static void phys_sleep_update(struct phys_sleep_ctx *ctx,
+                              struct phys_sleep_comp *sleep, uint64_t eid,
+                              struct vec3 vel, float mass)
+{
+    if (vec3_norm2(vel) >= ctx->max_speed * ctx->max_speed) {
+        sleep->n_still_ticks = 0;
+        return;
+    }
+
+    if (++sleep->n_still_ticks < ctx->n_ticks)
+        return;
+
+    sleep->mass = mass;
+    phys_sleep_queue(&ctx->sleeping, &ctx->n_sleeping,
+                     &ctx->n_allocd_sleeping, eid);
+}
+
+static void phys_sleep_tick_one(struct decs *decs, uint64_t eid,
+                                void *func_data)
+{
+    struct phys_sleep_sys_ctx *ctx = func_data;
+    struct phys_dyn_comp *dyn = ctx->phys_dyn_base + eid;
+
+    phys_sleep_update(ctx->phys_sleep_ctx, ctx->phys_sleep_base + eid, eid,
+                      dyn->vel, dyn->mass);
+}
+
+static void phys_sleep_soa_tick_one(struct decs *decs, uint64_t eid,
+                                    void *func_data)
+{
+    struct phys_sleep_soa_sys_ctx *ctx = func_data;
+    struct vec3 vel = {
+        ctx->vel[0][eid], ctx->vel[1][eid], ctx->vel[2][eid]
+    };
+
+    phys_sleep_update(ctx->phys_sleep_ctx, ctx->phys_sleep_base + eid, eid,
+                      vel, ctx->mass[eid]);
+}
+
+void phys_sleep_init(struct phys_sleep_ctx *ctx, struct entity_pool *pool,
+                     struct phys_col_world *world, uint64_t phys_sleep_id,
+                     uint64_t phys_dyn_id, const uint64_t *phys_soa_ids)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->pool = pool;
+    ctx->world = world;
+    ctx->phys_sleep_id = phys_sleep_id;
+    ctx->phys_dyn_id = phys_dyn_id;
+    ctx->phys_soa_ids = phys_soa_ids;
+    ctx->max_speed = PHYS_SLEEP_DEFAULT_SPEED;
+    ctx->n_ticks = PHYS_SLEEP_DEFAULT_TICKS;
+}
+
+void phys_sleep_wake(struct phys_sleep_ctx *ctx, uint64_t eid)
+{
+    phys_sleep_queue(&ctx->waking, &ctx->n_waking, &ctx->n_allocd_waking,
+                     eid);
+}
+
+static uint64_t phys_sleep_dyn_mask(const struct phys_sleep_ctx *ctx)
+{
+    if (ctx->phys_soa_ids)
+        return phys_soa_mask(ctx->phys_soa_ids);
+
+    return UINT64_C(1) << ctx->phys_dyn_id;
+}
+
+void phys_sleep_apply_force(struct phys_sleep_ctx *ctx, struct decs *decs,
+                            uint64_t eid, struct vec3 force)
+{
+    const uint64_t dyn_mask = phys_sleep_dyn_mask(ctx);
+    const uint64_t sleep_mask = UINT64_C(1) << ctx->phys_sleep_id;
+    const uint64_t comp_mask = decs->entity_comp_map[eid];
+    struct phys_sleep_comp *sleep;
+    struct phys_dyn_comp *dyn;
+    float *f;
+    int j;
+
+    if ((comp_mask & dyn_mask) == dyn_mask && ctx->phys_soa_ids) {
+        for (j = 0; j < 3; ++j) {
+            f = decs_get_comp(decs, ctx->phys_soa_ids[PHYS_SOA_FORCE_X + j],
+                              eid);
+            *f += force.e[j];
+        }
+    } else if ((comp_mask & dyn_mask) == dyn_mask) {
+        dyn = decs_get_comp(decs, ctx->phys_dyn_id, eid);
+        dyn->force = vec3_add(dyn->force, force);
+    } else if (comp_mask & sleep_mask) {
+        sleep = decs_get_comp(decs, ctx->phys_sleep_id, eid);
+        sleep->force = vec3_add(sleep->force, force);
+        phys_sleep_wake(ctx, eid);
+    }
+}
+
+static void phys_sleep_wake_pushed(void *data, uint64_t eid)
+{
+    phys_sleep_wake(data, eid);
+}
+
+void phys_sleep_tick(struct phys_sleep_ctx *ctx, struct decs *decs)
+{
+    const uint64_t dyn_mask = phys_sleep_dyn_mask(ctx);
+    const uint64_t sleep_mask = UINT64_C(1) << ctx->phys_sleep_id;
+    uint64_t *comp_map = decs->entity_comp_map;
+    struct phys_sleep_comp *sleep;
+    struct phys_dyn_comp dyn;
+    uint64_t eid;
+    size_t i;
+
+    phys_col_world_pushed(ctx->world, phys_sleep_wake_pushed, ctx);
+
+    for (i = 0; i < ctx->n_sleeping; ++i) {
+        eid = ctx->sleeping[i];
+        entity_pool_set_mask(ctx->pool, decs, eid, comp_map[eid] & ~dyn_mask);
+    }
+
+    /* Entities which are awake or never sleep, like the pins, are skipped */
+    for (i = 0; i < ctx->n_waking; ++i) {
+        eid = ctx->waking[i];
+        if ((comp_map[eid] & (sleep_mask | dyn_mask)) != sleep_mask)
+            continue;
+
+        sleep = decs_get_comp(decs, ctx->phys_sleep_id, eid);
+        sleep->n_still_ticks = 0;
+        dyn = (struct phys_dyn_comp) {
+            .force = sleep->force,
+            .mass = sleep->mass,
+        };
+        sleep->force = (struct vec3){ 0.0f, 0.0f, 0.0f };
+
+        if (ctx->phys_soa_ids)
+            phys_soa_set(decs, ctx->phys_soa_ids, eid, &dyn);
+        else
+            *(struct phys_dyn_comp *)decs_get_comp(decs, ctx->phys_dyn_id,
+                                                   eid) = dyn;
+
+        entity_pool_set_mask(ctx->pool, decs, eid, comp_map[eid] | dyn_mask);
+    }
+
+    ctx->n_sleeping = 0;
+    ctx->n_waking = 0;
+}
+
+void phys_sleep_cleanup(struct phys_sleep_ctx *ctx)
+{
+    free(ctx->sleeping);
+    free(ctx->waking);
+}
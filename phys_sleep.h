@@ -0,0 +1,96 @@
+#ifndef PHYS_SLEEP_H
+#define PHYS_SLEEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decs.h"
+#include "phys.h"
+#include "phys_soa.h"
+#include "phys_sphere_col.h"
+#include "entity_pool.h"
+
+/*
+ * The speed is above that of the small bounce a particle resting on the
+ * floor is kept in by the wall collision, and a thrown particle is slower
+ * than it for fewer ticks than this around the top of its arc.
+ */
+#define PHYS_SLEEP_DEFAULT_TICKS 30
+#define PHYS_SLEEP_DEFAULT_SPEED 0.2f
+
+/*
+ * Entities with this component are put to sleep once their speed has stayed
+ * under the threshold for a number of ticks. A sleeping entity has its
+ * dynamic components, phys_dyn or the phys_soa ones, removed from its mask,
+ * which leaves it out of all of the dynamic systems and has it collected as a
+ * static sphere by the collision world. A sleeper is woken up by a dynamic
+ * entity being pushed out of it or by a force applied to it. The dynamic
+ * components aren't moved along by the entity pool while they're off the
+ * mask, so they are rebuilt on waking up from the mass and the pending force
+ * kept here, at rest.
+ *
+ * The masks are changed through the entity pool, which keeps the sleepers in
+ * a range apart from the awake entities.
+ */
+struct phys_sleep_comp {
+    uint32_t n_still_ticks;
+    float mass;
+    struct vec3 force;
+};
+
+/* Aux context of the phys_sleep systems */
+struct phys_sleep_ctx {
+    struct entity_pool *pool;
+    struct phys_col_world *world;
+    uint64_t phys_sleep_id;
+    uint64_t phys_dyn_id;
+    const uint64_t *phys_soa_ids; /* NULL unless the phys_soa layout is used */
+
+    float max_speed;
+    uint32_t n_ticks;
+
+    /* Queued during the tick, applied by phys_sleep_tick() */
+    uint64_t *sleeping;
+    size_t n_sleeping;
+    size_t n_allocd_sleeping;
+    uint64_t *waking;
+    size_t n_waking;
+    size_t n_allocd_waking;
+};
+
+const struct system_reg phys_sleep_sys;
+
+/* Variant for entities using the phys_soa layout, see phys_soa.h */
+const struct system_reg phys_sleep_soa_sys;
+
+/* world is the collision world the sleepers are collected into */
+void phys_sleep_init(struct phys_sleep_ctx *ctx, struct entity_pool *pool,
+                     struct phys_col_world *world, uint64_t phys_sleep_id,
+                     uint64_t phys_dyn_id, const uint64_t *phys_soa_ids);
+
+/*
+ * Wakes eid up at the next phys_sleep_tick() if it's asleep. Serial only, and
+ * to be called once the entities of the tick have been allocated as the ids
+ * are queued.
+ */
+void phys_sleep_wake(struct phys_sleep_ctx *ctx, uint64_t eid);
+
+/*
+ * Adds force to the one eid is integrated with in the next tick it's awake,
+ * waking it up if it's asleep. To be called between ticks by anything pushing
+ * an entity from outside of the phys systems, with the same constraints as
+ * phys_sleep_wake().
+ */
+void phys_sleep_apply_force(struct phys_sleep_ctx *ctx, struct decs *decs,
+                            uint64_t eid, struct vec3 force);
+
+/*
+ * Wakes up the sleepers pushed into during the tick and applies the state
+ * changes queued since the last call, to be called after decs_tick() and
+ * before phys_col_world_tick(), while the entity ids haven't changed.
+ */
+void phys_sleep_tick(struct phys_sleep_ctx *ctx, struct decs *decs);
+
+void phys_sleep_cleanup(struct phys_sleep_ctx *ctx);
+
+#endif
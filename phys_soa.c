@@ -0,0 +1,355 @@
+#include <math.h>
+
+#include "phys_soa.h"
+#include "phys_kernels.h"
+#include "trace.h"
+
+void phys_drag_soa_tick(struct decs *, uint64_t, uint64_t, void *);
+void phys_gravity_soa_tick(struct decs *, uint64_t, uint64_t, void *);
+void phys_integrater_soa_tick(struct decs *, uint64_t, uint64_t, void *);
+void phys_wall_col_soa_tick(struct decs *, uint64_t, uint64_t, void *);
+void phys_post_col_soa_tick(struct decs *, uint64_t, uint64_t, void *);
+
+static const char *const phys_soa_comp_names[PHYS_SOA_N_FIELDS] = {
+    [PHYS_SOA_D_POS_X]  = "phys_d_pos_x",
+    [PHYS_SOA_D_POS_Y]  = "phys_d_pos_y",
+    [PHYS_SOA_D_POS_Z]  = "phys_d_pos_z",
+    [PHYS_SOA_VEL_X]    = "phys_vel_x",
+    [PHYS_SOA_VEL_Y]    = "phys_vel_y",
+    [PHYS_SOA_VEL_Z]    = "phys_vel_z",
+    [PHYS_SOA_FORCE_X]  = "phys_force_x",
+    [PHYS_SOA_FORCE_Y]  = "phys_force_y",
+    [PHYS_SOA_FORCE_Z]  = "phys_force_z",
+    [PHYS_SOA_MASS]     = "phys_mass",
+};
+
+struct phys_gravity_soa_ctx {
+    float *force_y;
+};
+
+struct phys_drag_soa_ctx {
+    float *vel[3];
+    float *force[3];
+};
+
+/* All of the fields, in phys_soa_field order */
+struct phys_integrate_soa_ctx {
+    float *f[PHYS_SOA_N_FIELDS];
+};
+
+struct phys_wall_col_soa_ctx {
+    struct phys_pos_comp *phys_pos_base;
+    float *d_pos_y;
+    float *vel_y;
+};
+
+struct phys_post_col_soa_ctx {
+    struct phys_pos_comp *phys_pos_base;
+    float *d_pos[3];
+};
+
+/* Work of a batch system, handed to the thread pool */
+struct phys_soa_job {
+    struct phys_pos_comp *pos;
+    float *f[PHYS_SOA_N_FIELDS];
+    float dt;
+    enum phys_integrator integrator;
+};
+
+const struct system_reg phys_drag_soa_sys = {
+    .name       = "phys_drag",
+    .comps      = STR_ARR("phys_vel_x", "phys_vel_y", "phys_vel_z",
+                          "phys_force_x", "phys_force_y", "phys_force_z"),
+    .func       = phys_drag_soa_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+    .post_deps  = STR_ARR("phys_integrate"),
+};
+
+const struct system_reg phys_gravity_soa_sys = {
+    .name       = "phys_gravity",
+    .comps      = STR_ARR("phys_force_y"),
+    .func       = phys_gravity_soa_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+    .post_deps  = STR_ARR("phys_integrate"),
+};
+
+const struct system_reg phys_integrate_soa_sys = {
+    .name       = "phys_integrate",
+    .comps      = STR_ARR("phys_d_pos_x", "phys_d_pos_y", "phys_d_pos_z",
+                          "phys_vel_x", "phys_vel_y", "phys_vel_z",
+                          "phys_force_x", "phys_force_y", "phys_force_z",
+                          "phys_mass"),
+    .func       = phys_integrater_soa_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+};
+
+const struct system_reg phys_wall_col_soa_sys = {
+    .name       = "phys_wall_col",
+    .comps      = STR_ARR("phys_pos", "phys_d_pos_y", "phys_vel_y"),
+    .func       = phys_wall_col_soa_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+    .pre_deps   = STR_ARR("phys_integrate"),
+};
+
+const struct system_reg phys_post_col_soa_sys = {
+    .name       = "phys_post_col",
+    .comps      = STR_ARR("phys_pos", "phys_d_pos_x", "phys_d_pos_y",
+                          "phys_d_pos_z"),
+    .func       = phys_post_col_soa_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+    .pre_deps   = STR_ARR("phys_wall_col"),
+};
+
+static void phys_gravity_soa_axis(float *restrict force_y, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        force_y[i] -= 9.81f;
+}
+
+static void phys_gravity_soa_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_soa_job *job = data;
+
+    phys_gravity_soa_axis(job->f[PHYS_SOA_FORCE_Y] + first, n);
+}
+
+void phys_gravity_soa_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                           void *func_data)
+{
+    struct phys_gravity_soa_ctx *ctx = func_data;
+    struct phys_soa_job job = {
+        .f[PHYS_SOA_FORCE_Y] = ctx->force_y + eid,
+    };
+    uint64_t span_start = trace_begin();
+
+    thread_pool_run(phys_get_thread_pool(), phys_gravity_soa_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_gravity", span_start);
+}
+
+static void phys_drag_soa_axis(float *restrict force,
+                               const float *restrict vel, size_t n)
+{
+    const float k = PHYS_TOTAL_DRAG_COEF;
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        force[i] += vel[i] * fabsf(vel[i]) * k;
+}
+
+static void phys_drag_soa_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_soa_job *job = data;
+    int j;
+
+    for (j = 0; j < 3; ++j)
+        phys_drag_soa_axis(job->f[PHYS_SOA_FORCE_X + j] + first,
+                           job->f[PHYS_SOA_VEL_X + j] + first, n);
+}
+
+void phys_drag_soa_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                        void *func_data)
+{
+    struct phys_drag_soa_ctx *ctx = func_data;
+    struct phys_soa_job job;
+    int j;
+    uint64_t span_start = trace_begin();
+
+    for (j = 0; j < 3; ++j) {
+        job.f[PHYS_SOA_VEL_X + j] = ctx->vel[j] + eid;
+        job.f[PHYS_SOA_FORCE_X + j] = ctx->force[j] + eid;
+    }
+
+    thread_pool_run(phys_get_thread_pool(), phys_drag_soa_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_drag", span_start);
+}
+
+static void phys_integrater_soa_axis(float *restrict d_pos,
+                                     float *restrict vel,
+                                     float *restrict force,
+                                     const float *restrict mass,
+                                     size_t n, float dt)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        vel[i] += force[i] * (1.0f / mass[i]) * dt;
+        d_pos[i] = vel[i] * dt;
+        force[i] = 0.0f;
+    }
+}
+
+/* The other schemes gather each entity, they have no vectorised kernels */
+static void phys_integrater_soa_gather_chunk(struct phys_soa_job *job,
+                                             size_t first, size_t n)
+{
+    float *const *f = job->f;
+    struct vec3 vel, d_pos, force;
+    size_t i;
+
+    for (i = first; i < first + n; ++i) {
+        vel = (struct vec3){ f[PHYS_SOA_VEL_X][i], f[PHYS_SOA_VEL_Y][i],
+                             f[PHYS_SOA_VEL_Z][i] };
+        force = (struct vec3){ f[PHYS_SOA_FORCE_X][i], f[PHYS_SOA_FORCE_Y][i],
+                               f[PHYS_SOA_FORCE_Z][i] };
+
+        phys_integrate(&vel, &d_pos, force, f[PHYS_SOA_MASS][i], job->dt,
+                       job->integrator);
+
+        f[PHYS_SOA_D_POS_X][i] = d_pos.x;
+        f[PHYS_SOA_D_POS_Y][i] = d_pos.y;
+        f[PHYS_SOA_D_POS_Z][i] = d_pos.z;
+        f[PHYS_SOA_VEL_X][i] = vel.x;
+        f[PHYS_SOA_VEL_Y][i] = vel.y;
+        f[PHYS_SOA_VEL_Z][i] = vel.z;
+        f[PHYS_SOA_FORCE_X][i] = 0.0f;
+        f[PHYS_SOA_FORCE_Y][i] = 0.0f;
+        f[PHYS_SOA_FORCE_Z][i] = 0.0f;
+    }
+}
+
+static void phys_integrater_soa_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_soa_job *job = data;
+    int j;
+
+    if (job->integrator != PHYS_INTEGRATOR_SYMPLECTIC_EULER) {
+        phys_integrater_soa_gather_chunk(job, first, n);
+        return;
+    }
+
+    for (j = 0; j < 3; ++j)
+        phys_integrater_soa_axis(job->f[PHYS_SOA_D_POS_X + j] + first,
+                                 job->f[PHYS_SOA_VEL_X + j] + first,
+                                 job->f[PHYS_SOA_FORCE_X + j] + first,
+                                 job->f[PHYS_SOA_MASS] + first, n, job->dt);
+}
+
+void phys_integrater_soa_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                              void *func_data)
+{
+    struct phys_integrate_soa_ctx *ctx = func_data;
+    struct phys_soa_job job = {
+        .dt = phys_get_dt(),
+        .integrator = phys_get_integrator(),
+    };
+    int j;
+    uint64_t span_start = trace_begin();
+
+    for (j = 0; j < PHYS_SOA_N_FIELDS; ++j)
+        job.f[j] = ctx->f[j] + eid;
+
+    thread_pool_run(phys_get_thread_pool(), phys_integrater_soa_chunk, &job,
+                    n, PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_integrate", span_start);
+}
+
+static void phys_wall_col_soa_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_soa_job *job = data;
+    struct phys_pos_comp *restrict pos = job->pos + first;
+    const float *restrict d_pos_y = job->f[PHYS_SOA_D_POS_Y] + first;
+    float *restrict vel_y = job->f[PHYS_SOA_VEL_Y] + first;
+    float hit;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        hit = fabsf(pos[i].pos.y + d_pos_y[i]) > 1.0f;
+        vel_y[i] *= 1.0f + (PHYS_WALL_BOUNCE - 1.0f) * hit;
+        pos[i].pos.y *= 1.0f - PHYS_WALL_EPSILON * hit;
+    }
+}
+
+void phys_wall_col_soa_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                            void *func_data)
+{
+    struct phys_wall_col_soa_ctx *ctx = func_data;
+    struct phys_soa_job job = {
+        .pos = ctx->phys_pos_base + eid,
+        .f[PHYS_SOA_D_POS_Y] = ctx->d_pos_y + eid,
+        .f[PHYS_SOA_VEL_Y] = ctx->vel_y + eid,
+    };
+    uint64_t span_start = trace_begin();
+
+    thread_pool_run(phys_get_thread_pool(), phys_wall_col_soa_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_wall_col", span_start);
+}
+
+static void phys_post_col_soa_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_soa_job *job = data;
+    struct phys_pos_comp *restrict pos = job->pos + first;
+    const float *restrict d_pos_x = job->f[PHYS_SOA_D_POS_X] + first;
+    const float *restrict d_pos_y = job->f[PHYS_SOA_D_POS_Y] + first;
+    const float *restrict d_pos_z = job->f[PHYS_SOA_D_POS_Z] + first;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        pos[i].pos.x += d_pos_x[i];
+        pos[i].pos.y += d_pos_y[i];
+        pos[i].pos.z += d_pos_z[i];
+    }
+}
+
+void phys_post_col_soa_tick(struct decs *decs, uint64_t eid, uint64_t n,
+                            void *func_data)
+{
+    struct phys_post_col_soa_ctx *ctx = func_data;
+    struct phys_soa_job job = {
+        .pos = ctx->phys_pos_base + eid,
+    };
+    int j;
+    uint64_t span_start = trace_begin();
+
+    for (j = 0; j < 3; ++j)
+        job.f[PHYS_SOA_D_POS_X + j] = ctx->d_pos[j] + eid;
+
+    thread_pool_run(phys_get_thread_pool(), phys_post_col_soa_chunk, &job, n,
+                    PHYS_BATCH_CHUNK_SIZE);
+
+    trace_end("phys_post_col", span_start);
+}
+
+void phys_soa_register_comps(struct entity_pool *pool, struct decs *decs,
+                             uint64_t ids[PHYS_SOA_N_FIELDS])
+{
+    int i;
+
+    for (i = 0; i < PHYS_SOA_N_FIELDS; ++i)
+        ids[i] = entity_pool_register_comp(pool, decs, phys_soa_comp_names[i],
+                                           sizeof(float));
+}
+
+uint64_t phys_soa_mask(const uint64_t ids[PHYS_SOA_N_FIELDS])
+{
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < PHYS_SOA_N_FIELDS; ++i)
+        mask |= UINT64_C(1) << ids[i];
+
+    return mask;
+}
+
+void phys_soa_set(struct decs *decs, const uint64_t ids[PHYS_SOA_N_FIELDS],
+                  uint64_t eid, const struct phys_dyn_comp *dyn)
+{
+    const float fields[PHYS_SOA_N_FIELDS] = {
+        dyn->d_pos.x, dyn->d_pos.y, dyn->d_pos.z,
+        dyn->vel.x, dyn->vel.y, dyn->vel.z,
+        dyn->force.x, dyn->force.y, dyn->force.z,
+        dyn->mass,
+    };
+    int i;
+
+    for (i = 0; i < PHYS_SOA_N_FIELDS; ++i)
+        *(float *)decs_get_comp(decs, ids[i], eid) = fields[i];
+}
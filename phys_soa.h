@@ -0,0 +1,46 @@
+#ifndef PHYS_SOA_H
+#define PHYS_SOA_H
+
+#include "phys.h"
+#include "entity_pool.h"
+
+/*
+ * Structure of arrays layout of phys_dyn_comp. Every field is registered as a
+ * float component of its own, so a system only streams the coordinates it
+ * actually uses, e.g. gravity moves 8 bytes per entity instead of 80. The
+ * systems below are batch systems registered under the names of their
+ * phys_dyn_comp counterparts, entities use the phys_soa components in place of
+ * phys_dyn.
+ */
+enum phys_soa_field {
+    PHYS_SOA_D_POS_X,
+    PHYS_SOA_D_POS_Y,
+    PHYS_SOA_D_POS_Z,
+    PHYS_SOA_VEL_X,
+    PHYS_SOA_VEL_Y,
+    PHYS_SOA_VEL_Z,
+    PHYS_SOA_FORCE_X,
+    PHYS_SOA_FORCE_Y,
+    PHYS_SOA_FORCE_Z,
+    PHYS_SOA_MASS,
+    PHYS_SOA_N_FIELDS,
+};
+
+const struct system_reg phys_drag_soa_sys;
+const struct system_reg phys_gravity_soa_sys;
+const struct system_reg phys_integrate_soa_sys;
+const struct system_reg phys_wall_col_soa_sys;
+const struct system_reg phys_post_col_soa_sys;
+
+/* Registers the float components, the ids are stored in ids */
+void phys_soa_register_comps(struct entity_pool *pool, struct decs *decs,
+                             uint64_t ids[PHYS_SOA_N_FIELDS]);
+
+/* Component mask with all of the phys_soa components set */
+uint64_t phys_soa_mask(const uint64_t ids[PHYS_SOA_N_FIELDS]);
+
+/* Scatters dyn into the phys_soa components of entity eid */
+void phys_soa_set(struct decs *decs, const uint64_t ids[PHYS_SOA_N_FIELDS],
+                  uint64_t eid, const struct phys_dyn_comp *dyn);
+
+#endif
@@ -1,12 +1,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include "phys.h"
 #include "phys_sphere_col.h"
+#include "trace.h"
 
 static void phys_sphere_col_build_tick(struct decs *decs, uint64_t eid,
                                        void *func_data);
+static void phys_sphere_col_build_batch_tick(struct decs *decs, uint64_t eid,
+                                             uint64_t n, void *func_data);
 
 struct phys_sphere_col_build_ctx {
     struct phys_col_world *phys_col_world; /* AUX */
@@ -14,16 +18,43 @@ struct phys_sphere_col_build_ctx {
     struct phys_sphere_comp *phys_sphere_base;
 };
 
+/* Sleeping entities aren't dynamic either and are collected with the pins */
 const struct system_reg phys_sphere_col_build_sys = {
     .name       = "phys_sphere_col_build",
     .comps      = STR_ARR("phys_pos", "phys_sphere_col"),
     .icomps     = STR_ARR("phys_dyn"),
     .func       = phys_sphere_col_build_tick,
-    .pre_deps   = STR_ARR("phys_integrate"),
+};
+
+/* Static colliders are the ones without the phys_soa components */
+const struct system_reg phys_sphere_col_build_soa_sys = {
+    .name       = "phys_sphere_col_build",
+    .comps      = STR_ARR("phys_pos", "phys_sphere_col"),
+    .icomps     = STR_ARR("phys_mass"),
+    .func       = phys_sphere_col_build_tick,
+};
+
+/* Batch variants of the above, which claim a whole run of entities at once */
+const struct system_reg phys_sphere_col_build_batch_sys = {
+    .name       = "phys_sphere_col_build",
+    .comps      = STR_ARR("phys_pos", "phys_sphere_col"),
+    .icomps     = STR_ARR("phys_dyn"),
+    .func       = phys_sphere_col_build_batch_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
+};
+
+const struct system_reg phys_sphere_col_build_soa_batch_sys = {
+    .name       = "phys_sphere_col_build",
+    .comps      = STR_ARR("phys_pos", "phys_sphere_col"),
+    .icomps     = STR_ARR("phys_mass"),
+    .func       = phys_sphere_col_build_batch_tick,
+    .flags      = DECS_SYS_FLAG_BATCH,
 };
 
 static void phys_sphere_col_tick(struct decs *decs, uint64_t eid,
                                  void *func_data);
+static void phys_sphere_col_batch_tick(struct decs *decs, uint64_t eid,
+                                       uint64_t n, void *func_data);
 
 struct phys_sphere_col_ctx {
     struct phys_col_world *phys_col_world; /* AUX */
@@ -36,37 +67,241 @@ const struct system_reg phys_sphere_col_sys = {
     .name       = "phys_sphere_col",
     .comps      = STR_ARR("phys_pos", "phys_dyn", "phys_sphere_col"),
     .func       = phys_sphere_col_tick,
-    .pre_deps   = STR_ARR("phys_sphere_col_build"),
+    .pre_deps   = STR_ARR("phys_integrate", "phys_wall_col",
+                          "phys_sphere_col_build"),
+    .post_deps  = STR_ARR("phys_post_col"),
+};
+
+/*
+ * Batch variant splitting the entities across the phys thread pool. The
+ * world is only read while they are resolved and every entity only writes
+ * its own components, so the result is the same as the serial one for any
+ * number of threads.
+ */
+const struct system_reg phys_sphere_col_batch_sys = {
+    .name       = "phys_sphere_col",
+    .comps      = STR_ARR("phys_pos", "phys_dyn", "phys_sphere_col"),
+    .func       = phys_sphere_col_batch_tick,
+    .pre_deps   = STR_ARR("phys_integrate", "phys_wall_col",
+                          "phys_sphere_col_build"),
+    .post_deps  = STR_ARR("phys_post_col"),
+    .flags      = DECS_SYS_FLAG_BATCH,
+};
+
+static void phys_sphere_col_soa_tick(struct decs *decs, uint64_t eid,
+                                     void *func_data);
+static void phys_sphere_col_soa_batch_tick(struct decs *decs, uint64_t eid,
+                                           uint64_t n, void *func_data);
+
+struct phys_sphere_col_soa_ctx {
+    struct phys_col_world *phys_col_world; /* AUX */
+    struct phys_pos_comp *phys_pos_base;
+    float *d_pos[3];
+    float *vel[3];
+    struct phys_sphere_comp *phys_sphere_base;
+};
+
+const struct system_reg phys_sphere_col_soa_sys = {
+    .name       = "phys_sphere_col",
+    .comps      = STR_ARR("phys_pos",
+                          "phys_d_pos_x", "phys_d_pos_y", "phys_d_pos_z",
+                          "phys_vel_x", "phys_vel_y", "phys_vel_z",
+                          "phys_sphere_col"),
+    .func       = phys_sphere_col_soa_tick,
+    .pre_deps   = STR_ARR("phys_integrate", "phys_wall_col",
+                          "phys_sphere_col_build"),
     .post_deps  = STR_ARR("phys_post_col"),
 };
 
+const struct system_reg phys_sphere_col_soa_batch_sys = {
+    .name       = "phys_sphere_col",
+    .comps      = STR_ARR("phys_pos",
+                          "phys_d_pos_x", "phys_d_pos_y", "phys_d_pos_z",
+                          "phys_vel_x", "phys_vel_y", "phys_vel_z",
+                          "phys_sphere_col"),
+    .func       = phys_sphere_col_soa_batch_tick,
+    .pre_deps   = STR_ARR("phys_integrate", "phys_wall_col",
+                          "phys_sphere_col_build"),
+    .post_deps  = STR_ARR("phys_post_col"),
+    .flags      = DECS_SYS_FLAG_BATCH,
+};
+
+static void phys_sphere_col_fused_tick(struct decs *decs, uint64_t eid,
+                                       void *func_data);
+static void phys_sphere_col_fused_batch_tick(struct decs *decs, uint64_t eid,
+                                             uint64_t n, void *func_data);
+
+/*
+ * For use with phys_fused_sys, which has already moved the entities by the
+ * time this runs. Colliding entities are moved back to where they were at
+ * the start of the tick and are then moved by the resolved d_pos.
+ */
+const struct system_reg phys_sphere_col_fused_sys = {
+    .name       = "phys_sphere_col",
+    .comps      = STR_ARR("phys_pos", "phys_dyn", "phys_sphere_col"),
+    .func       = phys_sphere_col_fused_tick,
+    .pre_deps   = STR_ARR("phys_sphere_col_build", "phys_fused"),
+};
+
+const struct system_reg phys_sphere_col_fused_batch_sys = {
+    .name       = "phys_sphere_col",
+    .comps      = STR_ARR("phys_pos", "phys_dyn", "phys_sphere_col"),
+    .func       = phys_sphere_col_fused_batch_tick,
+    .pre_deps   = STR_ARR("phys_sphere_col_build", "phys_fused"),
+    .flags      = DECS_SYS_FLAG_BATCH,
+};
+
+/* Work of a batch system, handed to the thread pool */
+struct phys_sphere_col_job {
+    struct decs *decs;
+    void *ctx;
+    uint64_t eid;
+};
+
 struct phys_col_sphere {
     struct vec3 c;
     float r;
 };
 
+/* n points away from the static sphere at c, dist is the sum of the radii */
+struct phys_col_contact {
+    struct vec3 c;
+    struct vec3 n;
+    float dist;
+};
+
+/*
+ * Makes room for n more spheres. The arrays are never shrunk, so once they
+ * have grown to the largest set seen they're reused without any allocations.
+ */
+static void phys_col_world_reserve(struct phys_col_world *world, size_t n)
+{
+    size_t n_allocd = world->n_allocd_spheres;
+
+    if (world->n_spheres + n <= world->n_allocd_spheres)
+        return;
+
+    if (!world->n_allocd_spheres)
+        world->n_allocd_spheres = 1;
+    while (world->n_spheres + n > world->n_allocd_spheres)
+        world->n_allocd_spheres *= 2;
+
+    world->spheres = realloc(world->spheres, sizeof(*world->spheres) *
+                                             world->n_allocd_spheres);
+    world->eids = realloc(world->eids, sizeof(*world->eids) *
+                                       world->n_allocd_spheres);
+    world->gens = realloc(world->gens, sizeof(*world->gens) *
+                                       world->n_allocd_spheres);
+    world->free = realloc(world->free, sizeof(*world->free) *
+                                       world->n_allocd_spheres);
+    world->claimed = realloc(world->claimed, world->n_allocd_spheres);
+    memset(world->claimed + n_allocd, 0, world->n_allocd_spheres - n_allocd);
+    world->pushed = realloc(world->pushed, world->n_allocd_spheres);
+    memset(world->pushed + n_allocd, 0, world->n_allocd_spheres - n_allocd);
+}
+
+/* Puts the entity eid into a free slot, recording the slot in sph */
+static void phys_col_world_add(struct phys_col_world *world, uint64_t eid,
+                               struct vec3 c, struct phys_sphere_comp *sph)
+{
+    uint32_t idx;
+
+    if (world->n_free) {
+        idx = world->free[--world->n_free];
+    } else {
+        phys_col_world_reserve(world, 1);
+        idx = world->n_spheres++;
+    }
+
+    /* Zero is left to the free slots and the new components */
+    if (!++world->gen)
+        ++world->gen;
+
+    world->spheres[idx] = (struct phys_col_sphere) {
+        .c = c,
+        .r = sph->r,
+    };
+    world->eids[idx] = eid;
+    world->gens[idx] = world->gen;
+    world->claimed[idx] = 1;
+
+    sph->col_idx = idx;
+    sph->col_gen = world->gen;
+
+    world->broadphase_dirty = true;
+}
+
+/*
+ * Claims the slot of the static entity eid for the tick, taking over its id,
+ * or adds the entity if it has none. That is the case for the entities which
+ * have just been created or put to sleep, and for all of them after
+ * phys_col_world_invalidate().
+ */
+static inline void phys_col_world_claim(struct phys_col_world *world,
+                                        uint64_t eid, struct vec3 c,
+                                        struct phys_sphere_comp *sph)
+{
+    const uint32_t idx = sph->col_idx;
+
+    if (!sph->col_gen || idx >= world->n_spheres ||
+        world->gens[idx] != sph->col_gen) {
+        phys_col_world_add(world, eid, c, sph);
+        return;
+    }
+
+    world->eids[idx] = eid;
+    world->claimed[idx] = 1;
+}
+
+/*
+ * Frees the slots which haven't been claimed during the tick, which has to
+ * happen after the build systems and before the first query so that neither
+ * a sleeper woken up nor a static entity gone is collided with
+ */
+static void phys_col_world_sweep(struct phys_col_world *world)
+{
+    size_t i;
+
+    for (i = 0; i < world->n_spheres; ++i) {
+        if (world->claimed[i]) {
+            world->claimed[i] = 0;
+            continue;
+        }
+        if (!world->gens[i])
+            continue;
+
+        world->gens[i] = 0;
+        world->free[world->n_free++] = i;
+        world->broadphase_dirty = true;
+    }
+
+    world->swept = true;
+}
+
 static void phys_sphere_col_build_tick(struct decs *decs, uint64_t eid,
                                        void *func_data)
 {
     struct phys_sphere_col_build_ctx *ctx = func_data;
     struct phys_pos_comp *pos = ctx->phys_pos_base + eid;
     struct phys_sphere_comp *sph = ctx->phys_sphere_base + eid;
-    struct phys_col_world *world = ctx->phys_col_world;
 
-    if (world->n_spheres + 1 >= world->n_allocd_spheres) {
-        if (!world->n_allocd_spheres)
-            world->n_allocd_spheres = 1;
-        world->n_allocd_spheres *= 2;
-        world->spheres = realloc(world->spheres, sizeof(*world->spheres) *
-                                                 world->n_allocd_spheres);
-    }
+    phys_col_world_claim(ctx->phys_col_world, eid, pos->pos, sph);
+}
 
-    world->spheres[world->n_spheres] = (struct phys_col_sphere) {
-        .c = pos->pos,
-        .r = sph->r,
-    };
+static void phys_sphere_col_build_batch_tick(struct decs *decs, uint64_t eid,
+                                             uint64_t n, void *func_data)
+{
+    struct phys_sphere_col_build_ctx *ctx = func_data;
+    const struct phys_pos_comp *pos = ctx->phys_pos_base + eid;
+    struct phys_sphere_comp *sph = ctx->phys_sphere_base + eid;
+    struct phys_col_world *world = ctx->phys_col_world;
+    uint64_t span_start = trace_begin();
+    uint64_t i;
 
-    ++world->n_spheres;
+    for (i = 0; i < n; ++i)
+        phys_col_world_claim(world, eid + i, pos[i].pos, sph + i);
+
+    trace_end("phys_sphere_col_build", span_start);
 }
 
 static inline int phys_sphere_col_test(struct phys_col_sphere a,
@@ -75,6 +310,616 @@ static inline int phys_sphere_col_test(struct phys_col_sphere a,
     return vec3_norm2(vec3_sub(a.c, b.c)) < (a.r + b.r) * (a.r + b.r);
 }
 
+/*
+ * Appends other to the n_hits long hits unless it's already there, a sphere
+ * may be found through more than one grid cell
+ */
+static inline size_t phys_col_hit(const struct phys_col_sphere **hits,
+                                  size_t n_hits,
+                                  const struct phys_col_sphere *other)
+{
+    size_t i;
+
+    for (i = 0; i < n_hits; ++i)
+        if (hits[i] == other)
+            return n_hits;
+
+    hits[n_hits] = other;
+
+    return n_hits + 1;
+}
+
+static inline int32_t phys_col_cell_coord(float x, float inv_cell_size)
+{
+    return (int32_t)floorf(x * inv_cell_size);
+}
+
+static inline uint32_t phys_col_cell_hash(int32_t x, int32_t y, int32_t z)
+{
+    return ((uint32_t)x * 73856093u) ^
+           ((uint32_t)y * 19349663u) ^
+           ((uint32_t)z * 83492791u);
+}
+
+static void phys_col_cell_range(const struct phys_col_grid *grid,
+                                struct phys_col_sphere sph,
+                                int32_t min[3], int32_t max[3])
+{
+    const float inv_cell_size = 1.0f / grid->cell_size;
+    int i;
+
+    for (i = 0; i < 3; ++i) {
+        min[i] = phys_col_cell_coord(sph.c.e[i] - sph.r, inv_cell_size);
+        max[i] = phys_col_cell_coord(sph.c.e[i] + sph.r, inv_cell_size);
+    }
+}
+
+/*
+ * Counting sort of the spheres into the hashed cells. The first pass counts
+ * the bucket sizes into start, which after the prefix sum holds the end
+ * offset of each bucket. The second pass walks the spheres backwards and
+ * fills each bucket from its end, which leaves start pointing at the bucket
+ * starts and keeps the spheres of a bucket in ascending order. The free slots
+ * are left out.
+ */
+static void phys_col_grid_build(struct phys_col_world *world)
+{
+    struct phys_col_grid *grid = &world->grid;
+    int32_t min[3], max[3];
+    int32_t x, y, z;
+    size_t n_cells = 64;
+    uint32_t cell_mask;
+    uint32_t h;
+    size_t i;
+
+    while (n_cells < world->n_spheres * 2)
+        n_cells *= 2;
+    cell_mask = n_cells - 1;
+
+    if (n_cells + 1 > grid->n_allocd_cells) {
+        grid->n_allocd_cells = n_cells + 1;
+        grid->start = realloc(grid->start,
+                              sizeof(*grid->start) * grid->n_allocd_cells);
+    }
+    grid->n_cells = n_cells;
+    memset(grid->start, 0, sizeof(*grid->start) * (n_cells + 1));
+
+    for (i = 0; i < world->n_spheres; ++i) {
+        if (!world->gens[i])
+            continue;
+        phys_col_cell_range(grid, world->spheres[i], min, max);
+        for (z = min[2]; z <= max[2]; ++z)
+            for (y = min[1]; y <= max[1]; ++y)
+                for (x = min[0]; x <= max[0]; ++x)
+                    ++grid->start[phys_col_cell_hash(x, y, z) & cell_mask];
+    }
+
+    for (i = 1; i < n_cells; ++i)
+        grid->start[i] += grid->start[i - 1];
+
+    grid->n_items = grid->start[n_cells - 1];
+    grid->start[n_cells] = grid->n_items;
+
+    if (grid->n_items > grid->n_allocd_items) {
+        grid->n_allocd_items = grid->n_items;
+        grid->items = realloc(grid->items,
+                              sizeof(*grid->items) * grid->n_allocd_items);
+    }
+
+    for (i = world->n_spheres; i--;) {
+        if (!world->gens[i])
+            continue;
+        phys_col_cell_range(grid, world->spheres[i], min, max);
+        for (z = min[2]; z <= max[2]; ++z) {
+            for (y = min[1]; y <= max[1]; ++y) {
+                for (x = min[0]; x <= max[0]; ++x) {
+                    h = phys_col_cell_hash(x, y, z) & cell_mask;
+                    grid->items[--grid->start[h]] = i;
+                }
+            }
+        }
+    }
+}
+
+static size_t phys_col_grid_find(const struct phys_col_world *world,
+                                 struct phys_col_sphere sph,
+                                 const struct phys_col_sphere **hits,
+                                 size_t max_hits)
+{
+    const struct phys_col_grid *grid = &world->grid;
+    const uint32_t cell_mask = grid->n_cells - 1;
+    const struct phys_col_sphere *other;
+    int32_t min[3], max[3];
+    int32_t x, y, z;
+    size_t n_hits = 0;
+    uint32_t h;
+    uint32_t i;
+
+    if (!grid->n_cells)
+        return 0;
+
+    phys_col_cell_range(grid, sph, min, max);
+    for (z = min[2]; z <= max[2]; ++z) {
+        for (y = min[1]; y <= max[1]; ++y) {
+            for (x = min[0]; x <= max[0]; ++x) {
+                h = phys_col_cell_hash(x, y, z) & cell_mask;
+                for (i = grid->start[h]; i < grid->start[h + 1]; ++i) {
+                    other = world->spheres + grid->items[i];
+                    if (!phys_sphere_col_test(*other, sph))
+                        continue;
+                    n_hits = phys_col_hit(hits, n_hits, other);
+                    if (n_hits == max_hits)
+                        return n_hits;
+                }
+            }
+        }
+    }
+
+    return n_hits;
+}
+
+struct phys_col_sap_item {
+    float min_x;
+    uint32_t idx;
+};
+
+static int phys_col_sap_cmp(const void *a, const void *b)
+{
+    const struct phys_col_sap_item *ia = a;
+    const struct phys_col_sap_item *ib = b;
+
+    if (ia->min_x < ib->min_x)
+        return -1;
+    if (ia->min_x > ib->min_x)
+        return 1;
+    return (ia->idx > ib->idx) - (ia->idx < ib->idx);
+}
+
+static void phys_col_sap_build(struct phys_col_world *world)
+{
+    struct phys_col_sap *sap = &world->sap;
+    struct phys_col_sphere *sph;
+    size_t i;
+
+    if (world->n_spheres > sap->n_allocd_items) {
+        sap->n_allocd_items = world->n_spheres;
+        sap->items = realloc(sap->items,
+                             sizeof(*sap->items) * sap->n_allocd_items);
+    }
+
+    sap->n_items = 0;
+    sap->max_r = 0.0f;
+    for (i = 0; i < world->n_spheres; ++i) {
+        if (!world->gens[i])
+            continue;
+        sph = world->spheres + i;
+        sap->items[sap->n_items++] = (struct phys_col_sap_item) {
+            .min_x = sph->c.x - sph->r,
+            .idx = i,
+        };
+        if (sph->r > sap->max_r)
+            sap->max_r = sph->r;
+    }
+
+    qsort(sap->items, sap->n_items, sizeof(*sap->items), phys_col_sap_cmp);
+}
+
+/*
+ * A sphere can only overlap the query if its lower x bound is within
+ * [min_x - 2 * max_r, max_x] of the query's extent, so the scan starts from a
+ * binary search of the lower end and stops at the first item past the upper
+ * end.
+ */
+static size_t phys_col_sap_find(const struct phys_col_world *world,
+                                struct phys_col_sphere sph,
+                                const struct phys_col_sphere **hits,
+                                size_t max_hits)
+{
+    const struct phys_col_sap *sap = &world->sap;
+    const float lo = sph.c.x - sph.r - 2.0f * sap->max_r;
+    const float hi = sph.c.x + sph.r;
+    const struct phys_col_sphere *other;
+    size_t first = 0, last = sap->n_items;
+    size_t n_hits = 0;
+    size_t mid;
+    size_t i;
+
+    while (first < last) {
+        mid = first + (last - first) / 2;
+        if (sap->items[mid].min_x < lo)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+    for (i = first; i < sap->n_items && sap->items[i].min_x <= hi; ++i) {
+        other = world->spheres + sap->items[i].idx;
+        if (!phys_sphere_col_test(*other, sph))
+            continue;
+        hits[n_hits++] = other;
+        if (n_hits == max_hits)
+            break;
+    }
+
+    return n_hits;
+}
+
+#define PHYS_COL_BVH_LEAF_SIZE 4
+#define PHYS_COL_BVH_MAX_DEPTH 64
+
+/*
+ * For inner nodes count is zero and first is the index of the left child, the
+ * right child being the next node. For leaves first indexes items.
+ */
+struct phys_col_bvh_node {
+    struct vec3 min;
+    struct vec3 max;
+    uint32_t first;
+    uint32_t count;
+};
+
+static void phys_col_bvh_leaf_bounds(const struct phys_col_world *world,
+                                     struct phys_col_bvh_node *node)
+{
+    const struct phys_col_bvh *bvh = &world->bvh;
+    struct phys_col_sphere sph;
+    uint32_t i;
+    int j;
+
+    for (j = 0; j < 3; ++j) {
+        node->min.e[j] = INFINITY;
+        node->max.e[j] = -INFINITY;
+    }
+
+    for (i = node->first; i < node->first + node->count; ++i) {
+        sph = world->spheres[bvh->items[i]];
+        for (j = 0; j < 3; ++j) {
+            node->min.e[j] = fminf(node->min.e[j], sph.c.e[j] - sph.r);
+            node->max.e[j] = fmaxf(node->max.e[j], sph.c.e[j] + sph.r);
+        }
+    }
+}
+
+/* Partitions items[first, last) so that the kth item is in its sorted place */
+static void phys_col_bvh_select(const struct phys_col_world *world,
+                                uint32_t *items, ptrdiff_t first,
+                                ptrdiff_t last, ptrdiff_t k, int axis)
+{
+    const struct phys_col_sphere *spheres = world->spheres;
+    uint32_t tmp;
+    float pivot;
+    ptrdiff_t i, j;
+
+    while (last - first > 1) {
+        pivot = spheres[items[first + (last - first) / 2]].c.e[axis];
+        i = first;
+        j = last - 1;
+        while (i <= j) {
+            while (spheres[items[i]].c.e[axis] < pivot)
+                ++i;
+            while (spheres[items[j]].c.e[axis] > pivot)
+                --j;
+            if (i <= j) {
+                tmp = items[i];
+                items[i++] = items[j];
+                items[j--] = tmp;
+            }
+        }
+
+        if (k <= j)
+            last = j + 1;
+        else if (k >= i)
+            first = i;
+        else
+            break;
+    }
+}
+
+static void phys_col_bvh_split(struct phys_col_world *world, uint32_t node_idx)
+{
+    struct phys_col_bvh *bvh = &world->bvh;
+    struct phys_col_bvh_node *node = bvh->nodes + node_idx;
+    const uint32_t first = node->first;
+    const uint32_t count = node->count;
+    struct vec3 ext;
+    uint32_t left;
+    int axis;
+
+    phys_col_bvh_leaf_bounds(world, node);
+    if (count <= PHYS_COL_BVH_LEAF_SIZE)
+        return;
+
+    ext = vec3_sub(node->max, node->min);
+    axis = ext.x > ext.y ? (ext.x > ext.z ? 0 : 2) : (ext.y > ext.z ? 1 : 2);
+
+    phys_col_bvh_select(world, bvh->items, first, first + count,
+                        first + count / 2, axis);
+
+    left = bvh->n_nodes;
+    bvh->n_nodes += 2;
+    bvh->nodes[left] = (struct phys_col_bvh_node) {
+        .first = first,
+        .count = count / 2,
+    };
+    bvh->nodes[left + 1] = (struct phys_col_bvh_node) {
+        .first = first + count / 2,
+        .count = count - count / 2,
+    };
+    node->first = left;
+    node->count = 0;
+
+    phys_col_bvh_split(world, left);
+    phys_col_bvh_split(world, left + 1);
+}
+
+static void phys_col_bvh_build(struct phys_col_world *world)
+{
+    struct phys_col_bvh *bvh = &world->bvh;
+    size_t max_nodes = 1;
+    size_t i;
+
+    while (max_nodes < world->n_spheres)
+        max_nodes *= 2;
+    max_nodes *= 2;
+
+    if (max_nodes > bvh->n_allocd_nodes) {
+        bvh->n_allocd_nodes = max_nodes;
+        bvh->nodes = realloc(bvh->nodes,
+                             sizeof(*bvh->nodes) * bvh->n_allocd_nodes);
+    }
+    if (world->n_spheres > bvh->n_allocd_items) {
+        bvh->n_allocd_items = world->n_spheres;
+        bvh->items = realloc(bvh->items,
+                             sizeof(*bvh->items) * bvh->n_allocd_items);
+    }
+
+    bvh->n_items = 0;
+    for (i = 0; i < world->n_spheres; ++i)
+        if (world->gens[i])
+            bvh->items[bvh->n_items++] = i;
+
+    /* Nodes left from an earlier build would point at spheres gone */
+    if (!bvh->n_items) {
+        bvh->n_nodes = 0;
+        return;
+    }
+
+    bvh->n_nodes = 1;
+    bvh->nodes[0] = (struct phys_col_bvh_node) {
+        .first = 0,
+        .count = bvh->n_items,
+    };
+    phys_col_bvh_split(world, 0);
+}
+
+static inline bool phys_col_bvh_overlap(const struct phys_col_bvh_node *node,
+                                        struct phys_col_sphere sph)
+{
+    int j;
+
+    for (j = 0; j < 3; ++j)
+        if (sph.c.e[j] + sph.r < node->min.e[j] ||
+            sph.c.e[j] - sph.r > node->max.e[j])
+            return false;
+
+    return true;
+}
+
+static size_t phys_col_bvh_find(const struct phys_col_world *world,
+                                struct phys_col_sphere sph,
+                                const struct phys_col_sphere **hits,
+                                size_t max_hits)
+{
+    const struct phys_col_bvh *bvh = &world->bvh;
+    const struct phys_col_bvh_node *node;
+    const struct phys_col_sphere *other;
+    uint32_t stack[PHYS_COL_BVH_MAX_DEPTH];
+    size_t n_stack = 0;
+    size_t n_hits = 0;
+    uint32_t i;
+
+    if (!bvh->n_nodes)
+        return 0;
+
+    stack[n_stack++] = 0;
+    while (n_stack) {
+        node = bvh->nodes + stack[--n_stack];
+        if (!phys_col_bvh_overlap(node, sph))
+            continue;
+
+        if (!node->count) {
+            stack[n_stack++] = node->first + 1;
+            stack[n_stack++] = node->first;
+            continue;
+        }
+
+        for (i = node->first; i < node->first + node->count; ++i) {
+            other = world->spheres + bvh->items[i];
+            if (!phys_sphere_col_test(*other, sph))
+                continue;
+            hits[n_hits++] = other;
+            if (n_hits == max_hits)
+                return n_hits;
+        }
+    }
+
+    return n_hits;
+}
+
+static size_t phys_col_brute_find(const struct phys_col_world *world,
+                                  struct phys_col_sphere sph,
+                                  const struct phys_col_sphere **hits,
+                                  size_t max_hits)
+{
+    size_t n_hits = 0;
+    size_t i;
+
+    for (i = 0; i < world->n_spheres && n_hits < max_hits; ++i)
+        if (world->gens[i] && phys_sphere_col_test(world->spheres[i], sph))
+            hits[n_hits++] = world->spheres + i;
+
+    return n_hits;
+}
+
+static void phys_col_world_build(struct phys_col_world *world)
+{
+    switch (world->broadphase) {
+    case PHYS_COL_BROADPHASE_GRID:
+        phys_col_grid_build(world);
+        break;
+    case PHYS_COL_BROADPHASE_SAP:
+        phys_col_sap_build(world);
+        break;
+    case PHYS_COL_BROADPHASE_BVH:
+        phys_col_bvh_build(world);
+        break;
+    case PHYS_COL_BROADPHASE_BRUTE:
+    default:
+        break;
+    }
+
+    world->broadphase_dirty = false;
+}
+
+/*
+ * Gets the world ready for the queries of the tick, by the first one. It's
+ * only read from then on, until phys_col_world_tick().
+ */
+static inline void phys_col_world_prepare(struct phys_col_world *world)
+{
+    if (!world->swept)
+        phys_col_world_sweep(world);
+
+    if (world->broadphase_dirty)
+        phys_col_world_build(world);
+}
+
+/*
+ * Stores up to max_hits spheres in the world overlapping sph in hits and
+ * returns their count
+ */
+static size_t phys_col_world_find(struct phys_col_world *world,
+                                  struct phys_col_sphere sph,
+                                  const struct phys_col_sphere **hits,
+                                  size_t max_hits)
+{
+    if (!world->n_spheres)
+        return 0;
+
+    phys_col_world_prepare(world);
+
+    switch (world->broadphase) {
+    case PHYS_COL_BROADPHASE_GRID:
+        return phys_col_grid_find(world, sph, hits, max_hits);
+    case PHYS_COL_BROADPHASE_SAP:
+        return phys_col_sap_find(world, sph, hits, max_hits);
+    case PHYS_COL_BROADPHASE_BVH:
+        return phys_col_bvh_find(world, sph, hits, max_hits);
+    case PHYS_COL_BROADPHASE_BRUTE:
+    default:
+        return phys_col_brute_find(world, sph, hits, max_hits);
+    }
+}
+
+/*
+ * Flags a push into the sphere idx, from any of the threads of the pool. The
+ * flag is read first as most of the spheres hit are pins, pushed into by
+ * several entities every tick.
+ */
+static void phys_col_world_push(struct phys_col_world *world, size_t idx)
+{
+    if (__atomic_load_n(world->pushed + idx, __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(world->pushed + idx, 1, __ATOMIC_RELAXED))
+        return;
+
+    __atomic_fetch_add(&world->n_pushed, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Resolves the collisions of a sphere of radius r at pos that is about to move
+ * by d_pos, d_pos and vel are updated in place.
+ *
+ * The spheres overlapping the destination are gathered into a contact list,
+ * which is then relaxed Gauss-Seidel style for a fixed number of iterations:
+ * each contact in turn pushes the sphere out along its normal by the
+ * remaining penetration depth and removes the velocity into it. The world
+ * only holds static spheres, so the contacts of different entities never
+ * interact and solving them per entity is the same as solving them all at
+ * once. The cost is bounded by PHYS_COL_MAX_CONTACTS and
+ * world->solver_iterations, a deep pile may be left slightly overlapping
+ * and is pushed out further in the next ticks. The spheres which pushed the
+ * entity out are recorded in the world.
+ */
+/* Returns nonzero if d_pos and vel were changed by a collision */
+static int phys_sphere_col_resolve(struct phys_col_world *world,
+                                   struct vec3 pos, float r,
+                                   struct vec3 *d_pos, struct vec3 *vel)
+{
+    const struct phys_col_sphere *hits[PHYS_COL_MAX_CONTACTS];
+    struct phys_col_contact contacts[PHYS_COL_MAX_CONTACTS];
+    struct phys_col_contact *contact;
+    struct phys_col_sphere sph = {
+        .c = vec3_add(pos, *d_pos),
+        .r = r * PHYS_COL_CONTACT_SKIN,
+    };
+    struct vec3 p = sph.c;
+    struct vec3 v = *vel;
+    struct vec3 delta;
+    float depth;
+    float len;
+    float vn;
+    unsigned iter;
+    uint32_t pushed = 0;
+    size_t n_contacts;
+    size_t i;
+
+    n_contacts = phys_col_world_find(world, sph, hits, PHYS_COL_MAX_CONTACTS);
+    if (!n_contacts)
+        return 0;
+
+    for (i = 0; i < n_contacts; ++i) {
+        contact = contacts + i;
+        delta = vec3_sub(p, hits[i]->c);
+        len = vec3_norm(delta);
+
+        contact->c = hits[i]->c;
+        contact->n = len > 0.0f ? vec3_muls(delta, 1.0f / len) :
+                                  (struct vec3){ 0.0f, 1.0f, 0.0f };
+        contact->dist = r + hits[i]->r;
+    }
+
+    for (iter = 0; iter < world->solver_iterations; ++iter) {
+        for (i = 0; i < n_contacts; ++i) {
+            contact = contacts + i;
+
+            depth = contact->dist -
+                    vec3_dot(vec3_sub(p, contact->c), contact->n);
+            if (depth <= 0.0f)
+                continue;
+
+            p = vec3_add(p, vec3_muls(contact->n, depth));
+            pushed |= UINT32_C(1) << i;
+
+            vn = vec3_dot(v, contact->n);
+            if (vn < 0.0f)
+                v = vec3_sub(v, vec3_muls(contact->n,
+                                          (1.0f + PHYS_COL_RESTITUTION) * vn));
+        }
+    }
+
+    if (!pushed)
+        return 0;
+
+    for (i = 0; i < n_contacts; ++i)
+        if (pushed & UINT32_C(1) << i)
+            phys_col_world_push(world, hits[i] - world->spheres);
+
+    *d_pos = vec3_sub(p, pos);
+    *vel = v;
+
+    return 1;
+}
+
 static void phys_sphere_col_tick(struct decs *decs, uint64_t eid,
                                  void *func_data)
 {
@@ -82,61 +927,195 @@ static void phys_sphere_col_tick(struct decs *decs, uint64_t eid,
     struct phys_pos_comp *pos = ctx->phys_pos_base + eid;
     struct phys_dyn_comp *dyn = ctx->phys_dyn_base + eid;
     struct phys_sphere_comp *sph = ctx->phys_sphere_base + eid;
-    struct phys_col_world *world = ctx->phys_col_world;
-    struct phys_col_sphere sph_a = {
-        .c = vec3_add(pos->pos, dyn->d_pos),
-        .r = sph->r,
-    };
-    struct phys_col_sphere sph_b;
-    struct vec3 n;
-    struct vec3 v;
-    size_t i;
-    bool clear;
 
-    for (i = 0, clear = true; i < world->n_spheres && clear; ++i) {
-        sph_b = world->spheres[i];
-        if (phys_sphere_col_test(sph_b, sph_a)) {
-            n = vec3_normalize(vec3_sub(sph_b.c, sph_a.c));
-            v = dyn->vel;
+    phys_sphere_col_resolve(ctx->phys_col_world, pos->pos, sph->r,
+                            &dyn->d_pos, &dyn->vel);
+}
 
-            dyn->d_pos = vec3_muls(dyn->d_pos, -0.1f);
-            dyn->vel = vec3_sub(v, vec3_muls(n, 2 * vec3_dot(v, n)));
-            clear = false;
-        }
+static void phys_sphere_col_fused_tick(struct decs *decs, uint64_t eid,
+                                       void *func_data)
+{
+    struct phys_sphere_col_ctx *ctx = func_data;
+    struct phys_pos_comp *pos = ctx->phys_pos_base + eid;
+    struct phys_dyn_comp *dyn = ctx->phys_dyn_base + eid;
+    struct phys_sphere_comp *sph = ctx->phys_sphere_base + eid;
+    struct vec3 start = vec3_sub(pos->pos, dyn->d_pos);
+
+    if (phys_sphere_col_resolve(ctx->phys_col_world, start, sph->r,
+                                &dyn->d_pos, &dyn->vel))
+        pos->pos = vec3_add(start, dyn->d_pos);
+}
+
+static void phys_sphere_col_soa_tick(struct decs *decs, uint64_t eid,
+                                     void *func_data)
+{
+    struct phys_sphere_col_soa_ctx *ctx = func_data;
+    struct phys_pos_comp *pos = ctx->phys_pos_base + eid;
+    struct phys_sphere_comp *sph = ctx->phys_sphere_base + eid;
+    struct vec3 d_pos;
+    struct vec3 vel;
+    int j;
+
+    for (j = 0; j < 3; ++j) {
+        d_pos.e[j] = ctx->d_pos[j][eid];
+        vel.e[j] = ctx->vel[j][eid];
     }
 
-    /*
-     * When a collision was detected, the entity was backed out along -d_pos.
-     * In order to properly resolve the collision, it has to be verified that
-     * the new position is also valid. The loop below backs the entity out
-     * until no collisions can be found
-     */
-    while (!clear) {
-        sph_a.c = vec3_add(pos->pos, dyn->d_pos);
-        for (i = 0, clear = true; i < world->n_spheres && clear; ++i) {
-            sph_b = world->spheres[i];
-            if (phys_sphere_col_test(sph_b, sph_a)) {
-                n = vec3_normalize(vec3_sub(sph_b.c, sph_a.c));
-                v = dyn->vel;
-
-                dyn->d_pos = vec3_add(dyn->d_pos, dyn->d_pos);
-                clear = false;
-            }
-        }
+    phys_sphere_col_resolve(ctx->phys_col_world, pos->pos, sph->r,
+                            &d_pos, &vel);
+
+    for (j = 0; j < 3; ++j) {
+        ctx->d_pos[j][eid] = d_pos.e[j];
+        ctx->vel[j][eid] = vel.e[j];
     }
 }
 
+static void phys_sphere_col_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_sphere_col_job *job = data;
+    uint64_t eid;
+
+    for (eid = job->eid + first; eid < job->eid + first + n; ++eid)
+        phys_sphere_col_tick(job->decs, eid, job->ctx);
+}
+
+static void phys_sphere_col_fused_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_sphere_col_job *job = data;
+    uint64_t eid;
+
+    for (eid = job->eid + first; eid < job->eid + first + n; ++eid)
+        phys_sphere_col_fused_tick(job->decs, eid, job->ctx);
+}
+
+static void phys_sphere_col_soa_chunk(void *data, size_t first, size_t n)
+{
+    struct phys_sphere_col_job *job = data;
+    uint64_t eid;
+
+    for (eid = job->eid + first; eid < job->eid + first + n; ++eid)
+        phys_sphere_col_soa_tick(job->decs, eid, job->ctx);
+}
+
+/*
+ * The world is otherwise prepared lazily by the first lookup, which has to
+ * happen before it's shared between the threads
+ */
+static void phys_sphere_col_batch_run(struct phys_col_world *world,
+                                      thread_pool_func func,
+                                      struct phys_sphere_col_job *job,
+                                      uint64_t n)
+{
+    if (!world->n_spheres)
+        return;
+
+    phys_col_world_prepare(world);
+
+    thread_pool_run(phys_get_thread_pool(), func, job, n,
+                    PHYS_COL_BATCH_CHUNK_SIZE);
+}
+
+static void phys_sphere_col_batch_tick(struct decs *decs, uint64_t eid,
+                                       uint64_t n, void *func_data)
+{
+    struct phys_sphere_col_ctx *ctx = func_data;
+    struct phys_sphere_col_job job = { decs, ctx, eid };
+    uint64_t span_start = trace_begin();
+
+    phys_sphere_col_batch_run(ctx->phys_col_world, phys_sphere_col_chunk,
+                              &job, n);
+
+    trace_end("phys_sphere_col", span_start);
+}
+
+static void phys_sphere_col_fused_batch_tick(struct decs *decs, uint64_t eid,
+                                             uint64_t n, void *func_data)
+{
+    struct phys_sphere_col_ctx *ctx = func_data;
+    struct phys_sphere_col_job job = { decs, ctx, eid };
+    uint64_t span_start = trace_begin();
+
+    phys_sphere_col_batch_run(ctx->phys_col_world,
+                              phys_sphere_col_fused_chunk, &job, n);
+
+    trace_end("phys_sphere_col", span_start);
+}
+
+static void phys_sphere_col_soa_batch_tick(struct decs *decs, uint64_t eid,
+                                           uint64_t n, void *func_data)
+{
+    struct phys_sphere_col_soa_ctx *ctx = func_data;
+    struct phys_sphere_col_job job = { decs, ctx, eid };
+    uint64_t span_start = trace_begin();
+
+    phys_sphere_col_batch_run(ctx->phys_col_world, phys_sphere_col_soa_chunk,
+                              &job, n);
+
+    trace_end("phys_sphere_col", span_start);
+}
+
 void phys_col_world_init(struct phys_col_world *world)
 {
     memset(world, 0, sizeof(*world));
+    world->broadphase = PHYS_COL_BROADPHASE_GRID;
+    world->grid.cell_size = PHYS_COL_DEFAULT_CELL_SIZE;
+    world->solver_iterations = PHYS_COL_DEFAULT_SOLVER_ITERATIONS;
+    world->broadphase_dirty = true;
 }
 
 void phys_col_world_tick(struct phys_col_world *world)
 {
+    /* Nothing has been queried, the slots are freed all the same */
+    if (!world->swept)
+        phys_col_world_sweep(world);
+    world->swept = false;
+
+    if (world->n_pushed)
+        memset(world->pushed, 0, world->n_spheres);
+    world->n_pushed = 0;
+}
+
+/*
+ * The generations keep counting up, so the slots recorded in the components
+ * never match the ones handed out from here on
+ */
+void phys_col_world_invalidate(struct phys_col_world *world)
+{
+    if (world->n_pushed)
+        memset(world->pushed, 0, world->n_spheres);
+    world->n_pushed = 0;
+
     world->n_spheres = 0;
+    world->n_free = 0;
+    world->swept = false;
+    world->broadphase_dirty = true;
+}
+
+void phys_col_world_pushed(const struct phys_col_world *world,
+                           void (*func)(void *data, uint64_t eid),
+                           void *data)
+{
+    size_t i;
+
+    if (!world->n_pushed)
+        return;
+
+    for (i = 0; i < world->n_spheres; ++i)
+        if (world->pushed[i])
+            func(data, world->eids[i]);
 }
 
 void phys_col_world_cleanup(struct phys_col_world *world)
 {
     free(world->spheres);
+    free(world->eids);
+    free(world->gens);
+    free(world->free);
+    free(world->claimed);
+    free(world->pushed);
+    free(world->grid.start);
+    free(world->grid.items);
+    free(world->sap.items);
+    free(world->bvh.nodes);
+    free(world->bvh.items);
 }
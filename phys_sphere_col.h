@@ -1,23 +1,160 @@
 #ifndef SPHERE_COL_H
 #define SPHERE_COL_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <decs.h>
 
 #include "vec3.h"
 
+#define PHYS_COL_DEFAULT_CELL_SIZE 0.25f
+
+/* Contacts resolved per entity and tick, any further overlaps are ignored */
+#define PHYS_COL_MAX_CONTACTS 8
+#define PHYS_COL_DEFAULT_SOLVER_ITERATIONS 8
+#define PHYS_COL_RESTITUTION 1.0f
+
+/*
+ * Contacts are gathered within this multiple of the radius, so that the
+ * spheres an entity is pushed into by the solver are already on its list
+ */
+#define PHYS_COL_CONTACT_SKIN 2.0f
+
+/*
+ * Entities per work item of the batch systems, smaller than the one of the
+ * other phys systems as an entity costs a lot more to resolve than to move
+ * and a pile of contacts in one chunk would otherwise hold up the rest
+ */
+#define PHYS_COL_BATCH_CHUNK_SIZE 256
+
+/*
+ * col_idx and col_gen are the slot of the entity in the collision world while
+ * it's a static collider, maintained by the build systems. The creators of the
+ * component zero them, which never matches a slot.
+ */
 struct phys_sphere_comp {
     float r;
+    uint32_t col_idx;
+    uint32_t col_gen;
 };
 
 const struct system_reg phys_sphere_col_build_sys;
+const struct system_reg phys_sphere_col_build_batch_sys;
 const struct system_reg phys_sphere_col_sys;
+const struct system_reg phys_sphere_col_batch_sys;
+
+/* Variants for entities using the phys_soa layout, see phys_soa.h */
+const struct system_reg phys_sphere_col_build_soa_sys;
+const struct system_reg phys_sphere_col_build_soa_batch_sys;
+const struct system_reg phys_sphere_col_soa_sys;
+const struct system_reg phys_sphere_col_soa_batch_sys;
+
+/* Variant running after phys_fused_sys, see phys.h */
+const struct system_reg phys_sphere_col_fused_sys;
+const struct system_reg phys_sphere_col_fused_batch_sys;
 
 struct phys_col_sphere;
 
+enum phys_col_broadphase {
+    PHYS_COL_BROADPHASE_BRUTE,  /* Test every sphere, kept for comparison */
+    PHYS_COL_BROADPHASE_GRID,   /* Uniform grid, hashed into a flat table */
+    PHYS_COL_BROADPHASE_SAP,    /* Sweep and prune along the x axis */
+    PHYS_COL_BROADPHASE_BVH,    /* AABB tree, built top-down */
+};
+
+/*
+ * Uniform grid. Every sphere is bucketed into all the cells its bounding box
+ * touches, the cell coordinates are hashed into n_cells buckets and the
+ * buckets are stored back to back in items, start[i] being the offset of the
+ * ith bucket.
+ */
+struct phys_col_grid {
+    float cell_size;
+    uint32_t *start;
+    size_t n_cells;
+    size_t n_allocd_cells;
+    uint32_t *items;
+    size_t n_items;
+    size_t n_allocd_items;
+};
+
+struct phys_col_sap_item;
+
+/* Sphere indices sorted by the lower bound of their x extent */
+struct phys_col_sap {
+    struct phys_col_sap_item *items;
+    size_t n_items;
+    size_t n_allocd_items;
+    float max_r;
+};
+
+struct phys_col_bvh_node;
+
+/*
+ * Binary AABB tree stored in an array, the two children of an inner node are
+ * stored next to each other. The spheres don't move, so the tree is only
+ * rebuilt when the set has changed.
+ */
+struct phys_col_bvh {
+    struct phys_col_bvh_node *nodes;
+    size_t n_nodes;
+    size_t n_allocd_nodes;
+    uint32_t *items;
+    size_t n_items;
+    size_t n_allocd_items;
+};
+
+/*
+ * The spheres are the static colliders, the entities with phys_sphere_col but
+ * without any dynamic components, pins as well as sleeping particles. They
+ * don't move, so the set and its broadphase structure are kept across ticks.
+ *
+ * Every sphere is a slot, which the entity holds the index and generation of
+ * in its component so that it keeps it as the pool moves it around. The build
+ * systems walk the static entities every tick, refreshing the entity ids of
+ * their slots and adding those without one. The slots no entity has claimed
+ * in the tick, of sleepers woken up or static entities despawned, are freed
+ * before the first query and reused by the next spheres added. Only the
+ * broadphase is rebuilt after any of these changes.
+ *
+ * The spheres a dynamic entity is pushed out of are recorded during the tick,
+ * so that the sleepers among them can be woken up, see phys_sleep.h.
+ */
 struct phys_col_world {
     struct phys_col_sphere *spheres;
-    size_t n_spheres;
+    uint64_t *eids;
+    uint32_t *gens;             /* Zero for the free slots */
+    size_t n_spheres;           /* Including the free slots */
     size_t n_allocd_spheres;
+    uint32_t gen;               /* The last one handed out */
+
+    /* Flags of the slots claimed during the tick, see phys_col_world_sweep() */
+    uint8_t *claimed;
+    bool swept;
+
+    uint32_t *free;
+    size_t n_free;
+
+    /* Flags of the spheres pushed into and their count */
+    uint8_t *pushed;
+    size_t n_pushed;
+
+    /*
+     * The broadphase structure is rebuilt lazily by the first query after the
+     * sphere set has changed.
+     */
+    enum phys_col_broadphase broadphase;
+    bool broadphase_dirty;
+    struct phys_col_grid grid;
+    struct phys_col_sap sap;
+    struct phys_col_bvh bvh;
+
+    /*
+     * Passes over the contacts of an entity, each one projecting the entity
+     * out of every contact it still penetrates
+     */
+    unsigned solver_iterations;
 };
 
 void phys_col_world_init(struct phys_col_world *world);
@@ -29,6 +166,26 @@ void phys_col_world_init(struct phys_col_world *world);
  */
 void phys_col_world_tick(struct phys_col_world *world);
 
+/*
+ * Drops all of the spheres, which are then collected again during the next
+ * tick. To be called between ticks when the components of the entities have
+ * been replaced wholesale, as by loading a snapshot. Static colliders created
+ * or destroyed are picked up by the build systems on their own.
+ */
+void phys_col_world_invalidate(struct phys_col_world *world);
+
+/*
+ * Calls func with the entity id of every sphere a dynamic entity was pushed
+ * out of during the tick, in the order of the slots so that it doesn't depend
+ * on the threads. To be called after decs_tick() and before
+ * phys_col_world_tick(), while the ids refreshed by the build systems are
+ * still those of the entities. The slots freed in the tick were out of the
+ * broadphase, so every sphere pushed into was claimed by its entity.
+ */
+void phys_col_world_pushed(const struct phys_col_world *world,
+                           void (*func)(void *data, uint64_t eid),
+                           void *data);
+
 void phys_col_world_cleanup(struct phys_col_world *world);
 
 #endif
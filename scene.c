@@ -0,0 +1,537 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "scene.h"
+#include "trace.h"
+#include "decs/sb.h"
+
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+/*
+ * Particles initialised per pass of scene_create_particles(), the values are
+ * computed into float streams which are then scattered into the components
+ */
+#define SCENE_SPAWN_CHUNK 256
+
+#define SCENE_PI 3.14159265f
+
+/* lowbias32 integer hash */
+static inline uint32_t scene_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+
+    return x;
+}
+
+/*
+ * sin(x) to within about 5e-6 for |x| < 100, in plain arithmetic that the
+ * spawn loops can be vectorised with. x is reduced to [-pi, pi] and folded
+ * into [0, pi/2] for the Taylor polynomial without any branches.
+ */
+static inline float scene_sinf(float x)
+{
+    float k = (int32_t)(x * (0.5f / SCENE_PI) + (x < 0.0f ? -0.5f : 0.5f));
+    float t, t2;
+
+    x -= k * (2.0f * SCENE_PI);
+    t = 0.5f * SCENE_PI - fabsf(fabsf(x) - 0.5f * SCENE_PI);
+    t2 = t * t;
+
+    return copysignf(t, x) *
+           (1.0f + t2 * (-1.0f / 6.0f + t2 * (1.0f / 120.0f +
+            t2 * (-1.0f / 5040.0f + t2 * (1.0f / 362880.0f)))));
+}
+
+static inline float scene_cosf(float x)
+{
+    return scene_sinf(x + 0.5f * SCENE_PI);
+}
+
+/* The random values of a chunk of particles, seeded by a hash of their index */
+struct scene_spawn_chunk {
+    float vel_x[SCENE_SPAWN_CHUNK];
+    float vel_y[SCENE_SPAWN_CHUNK];
+    float scale[SCENE_SPAWN_CHUNK];
+    float r[SCENE_SPAWN_CHUNK];
+    float g[SCENE_SPAWN_CHUNK];
+    float b[SCENE_SPAWN_CHUNK];
+};
+
+static void scene_spawn_chunk_init(struct scene_spawn_chunk *chunk,
+                                   uint64_t first_eid, uint32_t seed,
+                                   size_t n)
+{
+    /* The top 24 bits of a hash, which convert to float exactly */
+    const float to_angle = 2.0f * SCENE_PI / 16777216.0f;
+    const int32_t eid0 = first_eid;
+    float eid, angle, phase;
+    uint32_t h;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        h = scene_hash(seed + (uint32_t)i);
+        angle = (int32_t)(h >> 8) * to_angle;
+        phase = (int32_t)(scene_hash(h) >> 8) * to_angle;
+
+        chunk->vel_x[i] = scene_cosf(angle) * 0.5f;
+        chunk->vel_y[i] = scene_sinf(angle) * 0.5f;
+        chunk->scale[i] = 0.01f + (scene_sinf(phase) + 1.0f) * 0.01f;
+
+        eid = eid0 + (int32_t)i;
+        chunk->r[i] = scene_sinf(eid * 0.001f) * 1 + 1.0f;
+        chunk->g[i] = scene_cosf(eid * 0.003f) * 0.25f + 0.50f;
+        chunk->b[i] = scene_sinf(eid * 0.002f) * 0.5f + 1.5f;
+    }
+}
+
+void scene_create_particles(struct scene *scene, struct vec3 spawn_point,
+                            size_t n)
+{
+    struct decs *decs = &scene->decs;
+    const struct comp_ids *comp_ids = &scene->comp_ids;
+    struct scene_spawn_chunk chunk;
+    struct phys_pos_comp *phys_pos;
+    struct phys_pos_comp *phys_prev_pos;
+    struct lifetime_comp *lifetime;
+    struct phys_sleep_comp *sleep;
+    struct phys_sphere_comp *sph;
+    struct color_comp *color;
+    float *scale;
+#ifdef PHYS_SOA
+    float *soa[PHYS_SOA_N_FIELDS];
+    int j;
+#else
+    struct phys_dyn_comp *phys_dyn;
+#endif
+    const float mass = 7.0f;
+    uint64_t dyn_mask, comp_mask;
+    uint64_t first;
+    uint32_t seed;
+    size_t base, n_chunk;
+    size_t i, k;
+
+    if (!n)
+        return;
+
+#ifdef PHYS_SOA
+    dyn_mask = phys_soa_mask(comp_ids->phys_soa);
+#else
+    dyn_mask = UINT64_C(1) << comp_ids->phys_dyn;
+#endif
+
+    comp_mask = (UINT64_C(1) << comp_ids->phys_pos) |
+                (UINT64_C(1) << comp_ids->phys_prev_pos) |
+                dyn_mask |
+                (UINT64_C(1) << comp_ids->color) |
+                (UINT64_C(1) << comp_ids->scale) |
+                (UINT64_C(1) << comp_ids->phys_sphere_col) |
+                (UINT64_C(1) << comp_ids->lifetime) |
+                (UINT64_C(1) << comp_ids->phys_sleep);
+
+    first = entity_pool_alloc_range(&scene->entity_pool, decs, comp_mask, n);
+
+    phys_pos = decs_get_comp(decs, comp_ids->phys_pos, first);
+    phys_prev_pos = decs_get_comp(decs, comp_ids->phys_prev_pos, first);
+    color = decs_get_comp(decs, comp_ids->color, first);
+    scale = decs_get_comp(decs, comp_ids->scale, first);
+    sph = decs_get_comp(decs, comp_ids->phys_sphere_col, first);
+    lifetime = decs_get_comp(decs, comp_ids->lifetime, first);
+    sleep = decs_get_comp(decs, comp_ids->phys_sleep, first);
+#ifdef PHYS_SOA
+    for (j = 0; j < PHYS_SOA_N_FIELDS; ++j)
+        soa[j] = decs_get_comp(decs, comp_ids->phys_soa[j], first);
+#else
+    phys_dyn = decs_get_comp(decs, comp_ids->phys_dyn, first);
+#endif
+
+    seed = rand();
+
+    for (base = 0; base < n; base += n_chunk) {
+        n_chunk = n - base < SCENE_SPAWN_CHUNK ? n - base : SCENE_SPAWN_CHUNK;
+        scene_spawn_chunk_init(&chunk, first + base, seed + (uint32_t)base,
+                               n_chunk);
+
+        for (k = 0; k < n_chunk; ++k) {
+            i = base + k;
+
+            phys_pos[i].pos = spawn_point;
+            phys_prev_pos[i].pos = spawn_point;
+            color[i] = (struct color_comp) {
+                chunk.r[k], chunk.g[k], chunk.b[k]
+            };
+            scale[i] = chunk.scale[k];
+            sph[i] = (struct phys_sphere_comp) { .r = chunk.scale[k] * 0.5f };
+            lifetime[i].remaining = PARTICLE_LIFETIME;
+            sleep[i] = (struct phys_sleep_comp) { .mass = mass };
+#ifdef PHYS_SOA
+            soa[PHYS_SOA_D_POS_X][i] = 0.0f;
+            soa[PHYS_SOA_D_POS_Y][i] = 0.0f;
+            soa[PHYS_SOA_D_POS_Z][i] = 0.0f;
+            soa[PHYS_SOA_VEL_X][i] = chunk.vel_x[k];
+            soa[PHYS_SOA_VEL_Y][i] = chunk.vel_y[k];
+            soa[PHYS_SOA_VEL_Z][i] = 0.0f;
+            soa[PHYS_SOA_FORCE_X][i] = 0.0f;
+            soa[PHYS_SOA_FORCE_Y][i] = 0.0f;
+            soa[PHYS_SOA_FORCE_Z][i] = 0.0f;
+            soa[PHYS_SOA_MASS][i] = mass;
+#else
+            phys_dyn[i] = (struct phys_dyn_comp) {
+                .vel = { chunk.vel_x[k], chunk.vel_y[k], 0.0f },
+                .mass = mass,
+            };
+#endif
+        }
+    }
+}
+
+void scene_create_particle(struct scene *scene, struct vec3 spawn_point)
+{
+    scene_create_particles(scene, spawn_point, 1);
+}
+
+void scene_create_pin(struct scene *scene, struct vec3 pos)
+{
+    struct decs *decs = &scene->decs;
+    const struct comp_ids *comp_ids = &scene->comp_ids;
+    struct phys_pos_comp *phys_pos;
+    struct phys_pos_comp *phys_prev_pos;
+    struct color_comp *color;
+    struct phys_sphere_comp *sph;
+    float *scale;
+    uint64_t eid;
+
+    eid = entity_pool_alloc(&scene->entity_pool, decs,
+                            (UINT64_C(1) << comp_ids->phys_pos) |
+                            (UINT64_C(1) << comp_ids->phys_prev_pos) |
+                            (UINT64_C(1) << comp_ids->color) |
+                            (UINT64_C(1) << comp_ids->scale) |
+                            (UINT64_C(1) << comp_ids->phys_sphere_col));
+
+    phys_pos = decs_get_comp(decs, comp_ids->phys_pos, eid);
+    phys_prev_pos = decs_get_comp(decs, comp_ids->phys_prev_pos, eid);
+    color = decs_get_comp(decs, comp_ids->color, eid);
+    scale = decs_get_comp(decs, comp_ids->scale, eid);
+    sph = decs_get_comp(decs, comp_ids->phys_sphere_col, eid);
+
+    *color = (struct color_comp) { 0.8f, 0.8f, 0.8f };
+    *phys_pos = (struct phys_pos_comp) { .pos = pos };
+    *phys_prev_pos = *phys_pos;
+
+    *scale = 0.25f;
+    *sph = (struct phys_sphere_comp) { .r = *scale * 1.0f };
+}
+
+void scene_push(struct scene *scene, struct vec3 center, float radius,
+                float force)
+{
+    struct decs *decs = &scene->decs;
+    const struct comp_ids *comp_ids = &scene->comp_ids;
+    const uint64_t sleep_mask = UINT64_C(1) << comp_ids->phys_sleep;
+    const struct phys_pos_comp *pos;
+    struct vec3 delta;
+    float dist;
+    float scale;
+    uint64_t eid;
+
+    pos = decs->comps[comp_ids->phys_pos].data;
+
+    for (eid = 0; eid < scene->entity_pool.n_live; ++eid) {
+        if (!(decs->entity_comp_map[eid] & sleep_mask))
+            continue;
+
+        delta = vec3_sub(pos[eid].pos, center);
+        dist = vec3_norm(delta);
+        if (dist >= radius || dist <= 0.0f)
+            continue;
+
+        scale = force * (1.0f - dist / radius) / dist;
+        phys_sleep_apply_force(&scene->phys_sleep_ctx, decs, eid,
+                               vec3_muls(delta, scale));
+    }
+}
+
+int scene_init(struct scene *scene, float aspect)
+{
+    struct decs *decs = &scene->decs;
+    struct comp_ids *comp_ids = &scene->comp_ids;
+    struct entity_pool *pool = &scene->entity_pool;
+    size_t n_systems;
+    const char *name;
+    size_t i, j;
+    size_t len;
+    int err;
+
+    /* reads lists the comps a system doesn't write, for the scheduler */
+    struct {
+        const struct system_reg *sys_reg;
+        void *aux_ctx;
+        const char **reads;
+    } systems[] = {
+#if defined(PHYS_SOA)
+        { &phys_gravity_soa_sys, NULL },
+        { &phys_drag_soa_sys, NULL,
+          STR_ARR("phys_vel_x", "phys_vel_y", "phys_vel_z") },
+        { &phys_integrate_soa_sys, NULL, STR_ARR("phys_mass") },
+        { &phys_wall_col_soa_sys, NULL, STR_ARR("phys_d_pos_y") },
+        { &phys_post_col_soa_sys, NULL,
+          STR_ARR("phys_d_pos_x", "phys_d_pos_y", "phys_d_pos_z") },
+        { &phys_sphere_col_build_soa_batch_sys, &scene->phys_col_world,
+          STR_ARR("phys_pos", "phys_sphere_col") },
+        { &phys_sphere_col_soa_batch_sys, &scene->phys_col_world,
+          STR_ARR("phys_sphere_col") },
+        { &phys_sleep_soa_sys, &scene->phys_sleep_ctx,
+          STR_ARR("phys_vel_x", "phys_vel_y", "phys_vel_z", "phys_mass") },
+#elif defined(PHYS_FUSED)
+        { &phys_fused_sys, NULL },
+        { &phys_sphere_col_build_batch_sys, &scene->phys_col_world,
+          STR_ARR("phys_pos", "phys_sphere_col") },
+        { &phys_sphere_col_fused_batch_sys, &scene->phys_col_world,
+          STR_ARR("phys_sphere_col") },
+#elif 0
+        { &phys_gravity_sys, NULL },
+        { &phys_drag_sys, NULL },
+        { &phys_integrate_sys, NULL },
+        { &phys_wall_col_sys, NULL },
+        { &phys_post_col_sys, NULL },
+        { &phys_sphere_col_build_sys, &scene->phys_col_world,
+          STR_ARR("phys_pos", "phys_sphere_col") },
+        { &phys_sphere_col_sys, &scene->phys_col_world,
+          STR_ARR("phys_sphere_col") },
+#else
+        { &phys_gravity_batch_sys, NULL },
+        { &phys_drag_batch_sys, NULL },
+        { &phys_integrate_batch_sys, NULL },
+        { &phys_wall_col_batch_sys, NULL },
+        { &phys_post_col_batch_sys, NULL },
+        { &phys_sphere_col_build_batch_sys, &scene->phys_col_world,
+          STR_ARR("phys_pos", "phys_sphere_col") },
+        { &phys_sphere_col_batch_sys, &scene->phys_col_world,
+          STR_ARR("phys_sphere_col") },
+#endif
+#ifndef PHYS_SOA
+        { &phys_sleep_sys, &scene->phys_sleep_ctx, STR_ARR("phys_dyn") },
+#endif
+        { &lifetime_sys, &scene->lifetime_ctx, STR_ARR("phys_pos") },
+    };
+
+    decs_init(decs);
+    scene->trace_cycles = NULL;
+    scene->trace_est_names = NULL;
+    scene->parallel = false;
+    phys_col_world_init(&scene->phys_col_world);
+    entity_pool_init(pool);
+    sys_sched_init(&scene->sys_sched, decs, pool);
+    scene->lifetime_ctx = (struct lifetime_ctx) {
+        .pool = pool,
+        .min = { -0.25f - aspect, -1.25f, -1.0f },
+        .max = { 0.25f + aspect, 1.25f, 1.0f },
+        .dt = phys_get_dt(),
+    };
+
+    comp_ids->phys_pos =
+            entity_pool_register_comp(pool, decs, "phys_pos",
+                                      sizeof(struct phys_pos_comp));
+    comp_ids->phys_prev_pos =
+            entity_pool_register_comp(pool, decs, "phys_prev_pos",
+                                      sizeof(struct phys_pos_comp));
+    comp_ids->phys_dyn =
+            entity_pool_register_comp(pool, decs, "phys_dyn",
+                                      sizeof(struct phys_dyn_comp));
+    comp_ids->color = entity_pool_register_comp(pool, decs, "color",
+                                                sizeof(struct color_comp));
+    comp_ids->scale = entity_pool_register_comp(pool, decs, "scale",
+                                                sizeof(float));
+
+    comp_ids->phys_sphere_col =
+            entity_pool_register_comp(pool, decs, "phys_sphere_col",
+                                      sizeof(struct phys_sphere_comp));
+    comp_ids->lifetime =
+            entity_pool_register_comp(pool, decs, "lifetime",
+                                      sizeof(struct lifetime_comp));
+    comp_ids->phys_sleep =
+            entity_pool_register_comp(pool, decs, "phys_sleep",
+                                      sizeof(struct phys_sleep_comp));
+
+#ifdef PHYS_SOA
+    phys_soa_register_comps(pool, decs, comp_ids->phys_soa);
+    phys_sleep_init(&scene->phys_sleep_ctx, pool,
+                    &scene->phys_col_world, comp_ids->phys_sleep,
+                    comp_ids->phys_dyn, comp_ids->phys_soa);
+#else
+    phys_sleep_init(&scene->phys_sleep_ctx, pool,
+                    &scene->phys_col_world, comp_ids->phys_sleep,
+                    comp_ids->phys_dyn, NULL);
+#endif
+
+    for (i = 0; i < ARRAY_SIZE(systems); ++i) {
+        err = decs_register_system(decs, systems[i].sys_reg,
+                                   systems[i].aux_ctx, NULL);
+        if (err < 0) {
+            fprintf(stderr, "Error occurred while registering system \"%s\"\n",
+                    systems[i].sys_reg->name);
+            scene_cleanup(scene);
+            return err;
+        }
+
+        err = sys_sched_add(&scene->sys_sched, systems[i].sys_reg,
+                            systems[i].aux_ctx, systems[i].reads);
+        if (err < 0) {
+            scene_cleanup(scene);
+            return err;
+        }
+    }
+
+    decs_tick_dryrun(decs);
+
+    err = sys_sched_build(&scene->sys_sched);
+    if (err < 0) {
+        scene_cleanup(scene);
+        return err;
+    }
+
+    n_systems = sb_size(decs->systems);
+    scene->trace_cycles = malloc(sizeof(*scene->trace_cycles) * n_systems);
+    scene->trace_est_names = calloc(n_systems,
+                                    sizeof(*scene->trace_est_names));
+    if (!scene->trace_cycles || !scene->trace_est_names) {
+        scene_cleanup(scene);
+        return -1;
+    }
+
+    /* The batch systems record spans of their own */
+    for (i = 0; i < n_systems; ++i) {
+        name = decs->systems[i].name;
+        for (j = 0; j < ARRAY_SIZE(systems); ++j)
+            if (!strcmp(systems[j].sys_reg->name, name))
+                break;
+        if (j < ARRAY_SIZE(systems) &&
+            systems[j].sys_reg->flags & DECS_SYS_FLAG_BATCH)
+            continue;
+
+        len = strlen(name) + sizeof(" (est)");
+        scene->trace_est_names[i] = malloc(len);
+        if (!scene->trace_est_names[i]) {
+            scene_cleanup(scene);
+            return -1;
+        }
+        snprintf(scene->trace_est_names[i], len, "%s (est)", name);
+    }
+
+    return 0;
+}
+
+static void scene_trace_start_systems(struct scene *scene)
+{
+    size_t i;
+
+    for (i = 0; i < sb_size(scene->decs.systems); ++i)
+        scene->trace_cycles[i] = scene->decs.systems[i].perf_stats.cpu_cycles;
+}
+
+/*
+ * decs only counts the cycles of the systems. The batch systems record spans
+ * of their own, those of the others are estimated by splitting the decs_tick
+ * span in proportion to the cycles each system took and are named as
+ * estimates. Where they ran isn't known either, they are laid back to back
+ * at the end of the span.
+ */
+static void scene_trace_systems(struct scene *scene, uint64_t begin_ns,
+                                uint64_t end_ns)
+{
+    const struct system *systems = scene->decs.systems;
+    size_t n_systems = sb_size(systems);
+    long long total = 0;
+    uint64_t end = end_ns;
+    uint64_t dur;
+    size_t i;
+
+    trace_record("decs_tick", begin_ns, end_ns);
+
+    for (i = 0; i < n_systems; ++i) {
+        scene->trace_cycles[i] = systems[i].perf_stats.cpu_cycles -
+                                 scene->trace_cycles[i];
+        total += scene->trace_cycles[i];
+    }
+    if (total <= 0)
+        return;
+
+    for (i = n_systems; i--;) {
+        if (!scene->trace_est_names[i])
+            continue;
+
+        dur = (end_ns - begin_ns) * (double)scene->trace_cycles[i] / total;
+        trace_record(scene->trace_est_names[i], end - dur, end);
+        end -= dur;
+    }
+}
+
+void scene_tick(struct scene *scene)
+{
+    uint64_t span_start = trace_begin();
+
+    if (scene->parallel) {
+        sys_sched_tick(&scene->sys_sched, phys_get_thread_pool());
+        trace_end("sys_sched_tick", span_start);
+    } else {
+        if (span_start)
+            scene_trace_start_systems(scene);
+        decs_tick(&scene->decs);
+        if (span_start)
+            scene_trace_systems(scene, span_start, trace_now_ns());
+    }
+
+    span_start = trace_begin();
+    phys_sleep_tick(&scene->phys_sleep_ctx, &scene->decs);
+    trace_end("phys_sleep_tick", span_start);
+
+    span_start = trace_begin();
+    phys_col_world_tick(&scene->phys_col_world);
+    trace_end("phys_col_world_tick", span_start);
+
+    span_start = trace_begin();
+    entity_pool_tick(&scene->entity_pool, &scene->decs);
+    trace_end("entity_pool_tick", span_start);
+}
+
+void scene_set_parallel(struct scene *scene, bool parallel)
+{
+    scene->parallel = parallel;
+}
+
+void scene_set_dt(struct scene *scene, float dt)
+{
+    phys_set_dt(dt);
+    scene->lifetime_ctx.dt = dt;
+}
+
+void scene_save_prev_pos(struct scene *scene)
+{
+    const struct comp_ids *comp_ids = &scene->comp_ids;
+
+    memcpy(scene->decs.comps[comp_ids->phys_prev_pos].data,
+           scene->decs.comps[comp_ids->phys_pos].data,
+           scene->entity_pool.n_live * sizeof(struct phys_pos_comp));
+}
+
+void scene_cleanup(struct scene *scene)
+{
+    size_t i;
+
+    if (scene->trace_est_names)
+        for (i = 0; i < sb_size(scene->decs.systems); ++i)
+            free(scene->trace_est_names[i]);
+    free(scene->trace_est_names);
+
+    sys_sched_cleanup(&scene->sys_sched);
+    entity_pool_cleanup(&scene->entity_pool);
+    phys_sleep_cleanup(&scene->phys_sleep_ctx);
+    phys_col_world_cleanup(&scene->phys_col_world);
+    decs_cleanup(&scene->decs);
+    free(scene->trace_cycles);
+}
@@ -0,0 +1,108 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+
+#include "decs.h"
+#include "vec3.h"
+#include "phys.h"
+#include "phys_soa.h"
+#include "phys_sphere_col.h"
+#include "phys_sleep.h"
+#include "entity_pool.h"
+#include "lifetime.h"
+#include "sys_sched.h"
+
+#define PARTICLE_LIFETIME 30.0f /* Seconds */
+
+struct color_comp {
+    union {
+        struct vec3 color;
+        struct {
+            float r, g, b;
+        };
+    };
+};
+
+struct comp_ids {
+    uint64_t phys_pos;
+    uint64_t phys_prev_pos;
+    uint64_t phys_dyn;
+    uint64_t color;
+    uint64_t scale;
+    uint64_t phys_sphere_col;
+    uint64_t lifetime;
+    uint64_t phys_sleep;
+    uint64_t phys_soa[PHYS_SOA_N_FIELDS];
+};
+
+/*
+ * The particle simulation without any of the rendering, shared by particle
+ * and the headless benchmark so that both run the same set of systems.
+ */
+struct scene {
+    struct decs decs;
+    struct comp_ids comp_ids;
+    struct phys_col_world phys_col_world;
+    struct entity_pool entity_pool;
+    struct lifetime_ctx lifetime_ctx;
+    struct phys_sleep_ctx phys_sleep_ctx;
+    struct sys_sched sys_sched;
+    bool parallel;
+
+    /* Cycle counts of the systems at the start of a traced tick */
+    long long *trace_cycles;
+
+    /*
+     * Names of the estimated spans of the systems in the decs_tick() path,
+     * NULL for those recording their own
+     */
+    char **trace_est_names;
+};
+
+/*
+ * Registers the components and systems. Particles are despawned once they
+ * leave the [-aspect, aspect] x [-1, 1] view area, give or take a margin.
+ */
+int scene_init(struct scene *scene, float aspect);
+
+void scene_create_particle(struct scene *scene, struct vec3 spawn_point);
+
+/*
+ * Spawns n particles at once, their components being initialised a chunk at
+ * a time over the contiguous range they are allocated in
+ */
+void scene_create_particles(struct scene *scene, struct vec3 spawn_point,
+                            size_t n);
+void scene_create_pin(struct scene *scene, struct vec3 pos);
+
+/*
+ * Pushes the particles within radius of center away from it with a force
+ * falling off linearly from force at the center, the sleeping ones being
+ * woken up. To be called between ticks, after the particles of the next one
+ * have been created.
+ */
+void scene_push(struct scene *scene, struct vec3 center, float radius,
+                float force);
+
+void scene_tick(struct scene *scene);
+
+/*
+ * Ticks the systems through sys_sched on the physics thread pool instead of
+ * decs_tick(), which leaves the decs perf stats of the systems untouched
+ */
+void scene_set_parallel(struct scene *scene, bool parallel);
+
+/* Time step of the simulation, in seconds */
+void scene_set_dt(struct scene *scene, float dt);
+
+/*
+ * Copies phys_pos into phys_prev_pos, before the last tick of a frame so that
+ * the rendered positions can be interpolated between the two. Every entity
+ * with phys_pos also has phys_prev_pos, so they are moved around together.
+ */
+void scene_save_prev_pos(struct scene *scene);
+
+void scene_cleanup(struct scene *scene);
+
+#endif
@@ -1,43 +1,11 @@
 #include <alloca.h>
-#include <fcntl.h>
 #include <stdio.h>
 #include <sys/mman.h>
-#include <sys/stat.h>
 #include <stdarg.h>
 #include <unistd.h>
 
 #include "shader.h"
-
-void *mmap_file(const char *path, size_t *length)
-{
-    void *p = NULL;
-    int fd;
-    int ret;
-    struct stat st;
-
-    fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        perror("open failed");
-        return NULL;
-    }
-
-    ret = fstat(fd, &st);
-    if (ret < 0) {
-        perror("stat failed");
-        goto err_close;
-    }
-
-    if (length)
-        *length = st.st_size;
-
-    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    if (!p)
-        perror("mmap failed");
-
-err_close:
-    close(fd);
-    return p;
-}
+#include "mmap_file.h"
 
 GLuint load_shader_file(const char *path, GLenum shader_type)
 {
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "snapshot.h"
+#include "mmap_file.h"
+#include "decs/sb.h"
+
+#define SNAPSHOT_MAGIC "DECSSNAP"
+#define SNAPSHOT_VERSION 1
+
+/* Every section starts at a multiple of this */
+#define SNAPSHOT_ALIGN 64
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t broadphase;
+    float cell_size;
+    uint32_t pad;
+    uint64_t n_entities;
+    /* Zero for the components not in the snapshot */
+    uint64_t comp_sizes[ENTITY_POOL_MAX_COMPS];
+};
+
+/* Section offsets, map first, followed by the components in id order */
+struct snapshot_layout {
+    size_t map_offset;
+    size_t comp_offsets[ENTITY_POOL_MAX_COMPS];
+    size_t size;
+};
+
+static size_t snapshot_align(size_t offset)
+{
+    return (offset + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+}
+
+/*
+ * Fails when the sections don't fit in a size_t, the header of a loaded file
+ * being untrusted until its layout has been checked against the file size
+ */
+static int snapshot_layout(const struct snapshot_header *hdr,
+                           struct snapshot_layout *layout)
+{
+    /* Leaves room for aligning any offset below it */
+    const size_t max = SIZE_MAX - SNAPSHOT_ALIGN;
+    const uint64_t n = hdr->n_entities;
+    size_t offset;
+    size_t i;
+
+    layout->map_offset = snapshot_align(sizeof(*hdr));
+    if (n > (max - layout->map_offset) / sizeof(uint64_t))
+        return -1;
+    offset = layout->map_offset + n * sizeof(uint64_t);
+
+    for (i = 0; i < ENTITY_POOL_MAX_COMPS; ++i) {
+        layout->comp_offsets[i] = 0;
+        if (!hdr->comp_sizes[i])
+            continue;
+        offset = snapshot_align(offset);
+        if (n > (max - offset) / hdr->comp_sizes[i])
+            return -1;
+        layout->comp_offsets[i] = offset;
+        offset += n * hdr->comp_sizes[i];
+    }
+
+    layout->size = offset;
+
+    return 0;
+}
+
+/* Pads the file with zeros up to offset */
+static int snapshot_seek(FILE *f, size_t offset)
+{
+    static const char zeros[SNAPSHOT_ALIGN];
+    long pos = ftell(f);
+
+    if (pos < 0 || (size_t)pos > offset)
+        return -1;
+
+    if (fwrite(zeros, 1, offset - pos, f) != offset - pos)
+        return -1;
+
+    return 0;
+}
+
+int snapshot_save(const struct scene *scene, const char *path)
+{
+    const struct decs *decs = &scene->decs;
+    const struct entity_pool *pool = &scene->entity_pool;
+    struct snapshot_header hdr;
+    struct snapshot_layout layout;
+    size_t n_entities = pool->n_live;
+    size_t size;
+    size_t i;
+    FILE *f;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.broadphase = scene->phys_col_world.broadphase;
+    hdr.cell_size = scene->phys_col_world.grid.cell_size;
+    hdr.n_entities = n_entities;
+    for (i = 0; i < ENTITY_POOL_MAX_COMPS; ++i)
+        hdr.comp_sizes[i] = pool->comp_sizes[i];
+
+    if (snapshot_layout(&hdr, &layout)) {
+        fprintf(stderr, "Scene is too large for a snapshot\n");
+        return -1;
+    }
+
+    f = fopen(path, "wb");
+    if (!f) {
+        perror("Opening snapshot failed");
+        return -1;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+        goto err_write;
+
+    if (snapshot_seek(f, layout.map_offset) ||
+        fwrite(decs->entity_comp_map, sizeof(uint64_t), n_entities, f) !=
+        n_entities)
+        goto err_write;
+
+    for (i = 0; i < ENTITY_POOL_MAX_COMPS; ++i) {
+        size = n_entities * hdr.comp_sizes[i];
+        if (!size)
+            continue;
+        if (snapshot_seek(f, layout.comp_offsets[i]) ||
+            fwrite(decs->comps[i].data, 1, size, f) != size)
+            goto err_write;
+    }
+
+    if (fclose(f)) {
+        perror("Writing snapshot failed");
+        return -1;
+    }
+
+    return 0;
+
+err_write:
+    perror("Writing snapshot failed");
+    fclose(f);
+    return -1;
+}
+
+/*
+ * The component arrays are owned and grown by decs, so the sections can't be
+ * used from the mapping directly. They are copied over in one go instead,
+ * which leaves the page faults of the mapping as the main cost.
+ */
+int snapshot_load(struct scene *scene, const char *path)
+{
+    struct decs *decs = &scene->decs;
+    struct entity_pool *pool = &scene->entity_pool;
+    struct phys_sphere_comp *sph;
+    const struct snapshot_header *hdr;
+    struct snapshot_layout layout;
+    size_t n_entities;
+    size_t length;
+    size_t size;
+    size_t i;
+    char *p;
+    int ret = -1;
+
+    p = mmap_file(path, &length);
+    if (!p) {
+        fprintf(stderr, "Loading snapshot \"%s\" failed\n", path);
+        return -1;
+    }
+
+    hdr = (const struct snapshot_header *)p;
+    if (length < sizeof(*hdr) ||
+        memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "\"%s\" is not a snapshot\n", path);
+        goto out_unmap;
+    }
+
+    for (i = 0; i < ENTITY_POOL_MAX_COMPS; ++i) {
+        if (hdr->comp_sizes[i] != pool->comp_sizes[i]) {
+            fprintf(stderr, "Components of snapshot \"%s\" don't match\n",
+                    path);
+            goto out_unmap;
+        }
+    }
+
+    if (snapshot_layout(hdr, &layout) || length < layout.size) {
+        fprintf(stderr, "Snapshot \"%s\" is truncated\n", path);
+        goto out_unmap;
+    }
+
+    /* A zero, negative or NaN cell size would break the grid hashing */
+    if (hdr->broadphase > PHYS_COL_BROADPHASE_BVH ||
+        !isfinite(hdr->cell_size) || hdr->cell_size <= 0.0f) {
+        fprintf(stderr, "Broadphase of snapshot \"%s\" is invalid\n", path);
+        goto out_unmap;
+    }
+
+    n_entities = hdr->n_entities;
+
+    /* decs has no way to reserve entities up front */
+    while (sb_size(decs->entity_comp_map) < n_entities)
+        decs_alloc_entity(decs, 0);
+
+    memcpy(decs->entity_comp_map, p + layout.map_offset,
+           n_entities * sizeof(uint64_t));
+    memset(decs->entity_comp_map + n_entities, 0,
+           (sb_size(decs->entity_comp_map) - n_entities) * sizeof(uint64_t));
+
+    for (i = 0; i < ENTITY_POOL_MAX_COMPS; ++i) {
+        size = n_entities * hdr->comp_sizes[i];
+        if (size)
+            memcpy(decs->comps[i].data, p + layout.comp_offsets[i], size);
+    }
+
+    /* The slots are those of the world the snapshot was saved from */
+    sph = decs->comps[scene->comp_ids.phys_sphere_col].data;
+    for (i = 0; i < n_entities; ++i)
+        sph[i].col_gen = 0;
+
+    entity_pool_load(pool, decs, n_entities);
+
+    scene->phys_col_world.broadphase = hdr->broadphase;
+    scene->phys_col_world.grid.cell_size = hdr->cell_size;
+    phys_col_world_invalidate(&scene->phys_col_world);
+
+    ret = 0;
+
+out_unmap:
+    munmap(p, length);
+    return ret;
+}
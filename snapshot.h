@@ -0,0 +1,22 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "scene.h"
+
+/*
+ * Scene snapshots. The file is a header followed by the entity map and the
+ * component arrays of the live entities, each in one contiguous section, so
+ * that a load is a mapping of the file and one copy per section.
+ *
+ * A snapshot can only be loaded by a build registering the same components
+ * in the same order, which is checked against the component sizes stored in
+ * the header.
+ */
+
+/* Writes the live entities of scene to path, to be called between ticks */
+int snapshot_save(const struct scene *scene, const char *path);
+
+/* Replaces all of the entities of scene with the ones stored in path */
+int snapshot_load(struct scene *scene, const char *path);
+
+#endif
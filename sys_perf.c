@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sys_perf.h"
+#include "decs/sb.h"
+
+static const struct {
+    const char *name;
+    size_t offset;
+} sys_perf_fields[SYS_PERF_N_FIELDS] = {
+    [SYS_PERF_CYCLES] = {
+        "cycles", offsetof(struct perf_stats, cpu_cycles)
+    },
+    [SYS_PERF_CACHE_REFS] = {
+        "cache_refs", offsetof(struct perf_stats, cache_refs)
+    },
+    [SYS_PERF_CACHE_MISSES] = {
+        "cache_misses", offsetof(struct perf_stats, cache_misses)
+    },
+    [SYS_PERF_BRANCH_INSTRS] = {
+        "branch_instrs", offsetof(struct perf_stats, branch_instrs)
+    },
+    [SYS_PERF_BRANCH_MISSES] = {
+        "branch_misses", offsetof(struct perf_stats, branch_misses)
+    },
+};
+
+const char *sys_perf_field_name(enum sys_perf_field field)
+{
+    return sys_perf_fields[field].name;
+}
+
+long long sys_perf_field_value(const struct perf_stats *stats,
+                               enum sys_perf_field field)
+{
+    const char *p = (const char *)stats + sys_perf_fields[field].offset;
+
+    return *(const long long *)p;
+}
+
+int sys_perf_parse_fields(const char *list, unsigned *fields)
+{
+    const char *end;
+    size_t len;
+    unsigned i;
+
+    *fields = 0;
+    for (; *list; list = *end ? end + 1 : end) {
+        end = strchr(list, ',');
+        if (!end)
+            end = list + strlen(list);
+        len = end - list;
+
+        for (i = 0; i < SYS_PERF_N_FIELDS; ++i) {
+            if (strlen(sys_perf_fields[i].name) == len &&
+                !strncmp(sys_perf_fields[i].name, list, len))
+                break;
+        }
+        if (i == SYS_PERF_N_FIELDS) {
+            fprintf(stderr, "Unknown perf field \"%.*s\"\n", (int)len, list);
+            return -1;
+        }
+        *fields |= 1u << i;
+    }
+
+    return 0;
+}
+
+int sys_perf_init(struct sys_perf *perf, const struct decs *decs,
+                  unsigned fields)
+{
+    size_t i;
+
+    memset(perf, 0, sizeof(*perf));
+    perf->fields = fields;
+    perf->n_systems = sb_size(decs->systems);
+    perf->systems = calloc(perf->n_systems, sizeof(*perf->systems));
+    if (!perf->systems)
+        return -1;
+
+    /* The counters are cumulative and may already include the dry run */
+    for (i = 0; i < perf->n_systems; ++i)
+        perf->systems[i].last = decs->systems[i].perf_stats;
+
+    return 0;
+}
+
+static void sys_perf_write_csv(struct sys_perf *perf, const struct decs *decs)
+{
+    const struct sys_perf_sys *sys;
+    size_t i;
+    unsigned j;
+
+    for (i = 0; i < perf->n_systems; ++i) {
+        sys = perf->systems + i;
+        fprintf(perf->csv, "%lu,%s,%zu", perf->n_samples,
+                decs->systems[i].name, perf->n_entities);
+        for (j = 0; j < SYS_PERF_N_FIELDS; ++j) {
+            if (!(perf->fields & (1u << j)))
+                continue;
+            fprintf(perf->csv, ",%.0f,%.3f", sys->delta[j],
+                    perf->n_entities ? sys->delta[j] / perf->n_entities : 0.0);
+        }
+        fputc('\n', perf->csv);
+    }
+}
+
+void sys_perf_sample(struct sys_perf *perf, const struct decs *decs,
+                     size_t n_entities)
+{
+    const struct perf_stats *stats;
+    struct sys_perf_sys *sys;
+    size_t i;
+    unsigned j;
+
+    for (i = 0; i < perf->n_systems; ++i) {
+        sys = perf->systems + i;
+        stats = &decs->systems[i].perf_stats;
+
+        for (j = 0; j < SYS_PERF_N_FIELDS; ++j) {
+            sys->delta[j] = sys_perf_field_value(stats, j) -
+                            sys_perf_field_value(&sys->last, j);
+            if (perf->n_samples)
+                sys->avg[j] += (sys->delta[j] - sys->avg[j]) *
+                               SYS_PERF_EMA_WEIGHT;
+            else
+                sys->avg[j] = sys->delta[j];
+        }
+        sys->last = *stats;
+    }
+
+    perf->n_entities = n_entities;
+    if (perf->csv)
+        sys_perf_write_csv(perf, decs);
+    ++perf->n_samples;
+}
+
+int sys_perf_open_csv(struct sys_perf *perf, const char *path)
+{
+    unsigned j;
+
+    sys_perf_close_csv(perf);
+
+    perf->csv = fopen(path, "w");
+    if (!perf->csv) {
+        perror("Opening perf CSV failed");
+        return -1;
+    }
+
+    fputs("tick,system,entities", perf->csv);
+    for (j = 0; j < SYS_PERF_N_FIELDS; ++j) {
+        if (perf->fields & (1u << j))
+            fprintf(perf->csv, ",%s,%s_per_entity", sys_perf_fields[j].name,
+                    sys_perf_fields[j].name);
+    }
+    fputc('\n', perf->csv);
+
+    return 0;
+}
+
+void sys_perf_close_csv(struct sys_perf *perf)
+{
+    if (!perf->csv)
+        return;
+
+    if (fclose(perf->csv))
+        perror("Writing perf CSV failed");
+    perf->csv = NULL;
+}
+
+void sys_perf_cleanup(struct sys_perf *perf)
+{
+    sys_perf_close_csv(perf);
+    free(perf->systems);
+}
@@ -0,0 +1,73 @@
+#ifndef SYS_PERF_H
+#define SYS_PERF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "decs.h"
+
+/*
+ * Per system hardware counters on top of the cumulative perf_stats kept by
+ * decs. Each sample takes the deltas since the previous one, which are kept
+ * along with an exponential moving average and optionally written out as
+ * CSV, normalised by the entity count of the tick.
+ *
+ * The events are the ones decs counts, the fields only select which of them
+ * are shown and exported.
+ */
+
+enum sys_perf_field {
+    SYS_PERF_CYCLES,
+    SYS_PERF_CACHE_REFS,    /* Last level cache */
+    SYS_PERF_CACHE_MISSES,
+    SYS_PERF_BRANCH_INSTRS,
+    SYS_PERF_BRANCH_MISSES,
+    SYS_PERF_N_FIELDS,
+};
+
+#define SYS_PERF_ALL_FIELDS ((1u << SYS_PERF_N_FIELDS) - 1)
+
+/* Weight of the latest sample in the averages, about the last 20 ticks */
+#define SYS_PERF_EMA_WEIGHT 0.05
+
+struct sys_perf_sys {
+    struct perf_stats last;
+    double delta[SYS_PERF_N_FIELDS];
+    double avg[SYS_PERF_N_FIELDS];
+};
+
+struct sys_perf {
+    unsigned fields; /* Bit mask of sys_perf_field */
+    struct sys_perf_sys *systems;
+    size_t n_systems;
+    size_t n_entities; /* Of the last sample */
+    unsigned long n_samples;
+    FILE *csv;
+};
+
+/* To be called once all of the systems have been registered */
+int sys_perf_init(struct sys_perf *perf, const struct decs *decs,
+                  unsigned fields);
+
+/* Name used in the CSV header and by sys_perf_parse_fields() */
+const char *sys_perf_field_name(enum sys_perf_field field);
+long long sys_perf_field_value(const struct perf_stats *stats,
+                               enum sys_perf_field field);
+
+/* Parses a comma separated list of field names into a mask, -1 on error */
+int sys_perf_parse_fields(const char *list, unsigned *fields);
+
+/* To be called after each tick, n_entities being the ones it ran on */
+void sys_perf_sample(struct sys_perf *perf, const struct decs *decs,
+                     size_t n_entities);
+
+/*
+ * Starts writing a row per system and sample to path, with the selected
+ * fields per tick and per entity
+ */
+int sys_perf_open_csv(struct sys_perf *perf, const char *path);
+void sys_perf_close_csv(struct sys_perf *perf);
+
+void sys_perf_cleanup(struct sys_perf *perf);
+
+#endif
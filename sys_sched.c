@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sys_sched.h"
+#include "trace.h"
+
+typedef void (*sys_sched_func)(struct decs *, uint64_t, void *);
+typedef void (*sys_sched_batch_func)(struct decs *, uint64_t, uint64_t,
+                                     void *);
+
+/* The systems of a wave, handed to the thread pool */
+struct sys_sched_job {
+    struct sys_sched *sched;
+    const size_t *systems;
+};
+
+void sys_sched_init(struct sys_sched *sched, struct decs *decs,
+                    struct entity_pool *pool)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->decs = decs;
+    sched->pool = pool;
+}
+
+static int sys_sched_find_comp(const struct entity_pool *pool,
+                               const char *name, uint64_t *comp_id)
+{
+    uint64_t i;
+
+    for (i = 0; i < ENTITY_POOL_MAX_COMPS; ++i) {
+        if (pool->comp_names[i] && !strcmp(pool->comp_names[i], name)) {
+            *comp_id = i;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Unknown component \"%s\"\n", name);
+
+    return -1;
+}
+
+int sys_sched_add(struct sys_sched *sched, const struct system_reg *reg,
+                  void *aux, const char **reads)
+{
+    struct sys_sched_sys *sys;
+    uint64_t comp_id;
+    const char **name;
+
+    if (sched->n_systems + 1 > sched->n_allocd_systems) {
+        sched->n_allocd_systems = sched->n_allocd_systems ?
+                                  sched->n_allocd_systems * 2 : 8;
+        sched->systems = realloc(sched->systems, sizeof(*sched->systems) *
+                                                 sched->n_allocd_systems);
+        if (!sched->systems)
+            return -1;
+    }
+
+    sys = sched->systems + sched->n_systems;
+    memset(sys, 0, sizeof(*sys));
+    sys->reg = reg;
+    sys->aux = aux;
+
+    for (name = reg->comps; name && *name; ++name) {
+        if (sys_sched_find_comp(sched->pool, *name, &comp_id))
+            return -1;
+        sys->comp_ids[sys->n_comps++] = comp_id;
+        sys->comp_mask |= UINT64_C(1) << comp_id;
+    }
+    for (name = reg->icomps; name && *name; ++name) {
+        if (sys_sched_find_comp(sched->pool, *name, &comp_id))
+            return -1;
+        sys->icomp_mask |= UINT64_C(1) << comp_id;
+    }
+
+    sys->write_mask = sys->comp_mask;
+    for (name = reads; name && *name; ++name) {
+        if (sys_sched_find_comp(sched->pool, *name, &comp_id))
+            return -1;
+        sys->write_mask &= ~(UINT64_C(1) << comp_id);
+    }
+
+    ++sched->n_systems;
+
+    return 0;
+}
+
+static bool sys_sched_conflict(const struct sys_sched_sys *a,
+                               const struct sys_sched_sys *b)
+{
+    if (a->aux && a->aux == b->aux)
+        return true;
+
+    if ((a->comp_mask & b->icomp_mask) || (b->comp_mask & a->icomp_mask))
+        return false;
+
+    return (a->write_mask & b->comp_mask) || (b->write_mask & a->comp_mask);
+}
+
+/* Sets deps[i * n + j] for the systems named in names */
+static void sys_sched_add_deps(const struct sys_sched *sched, bool *deps,
+                               size_t sys_idx, const char **names,
+                               bool pre)
+{
+    const size_t n = sched->n_systems;
+    const char **name;
+    size_t i;
+
+    /* Dependencies on systems that aren't registered are ignored */
+    for (name = names; name && *name; ++name) {
+        for (i = 0; i < n; ++i) {
+            if (strcmp(sched->systems[i].reg->name, *name))
+                continue;
+            if (pre)
+                deps[i * n + sys_idx] = true;
+            else
+                deps[sys_idx * n + i] = true;
+        }
+    }
+}
+
+int sys_sched_build(struct sys_sched *sched)
+{
+    const size_t n = sched->n_systems;
+    const struct sys_sched_sys *sys;
+    bool *deps = NULL;
+    bool *done = NULL;
+    size_t *topo = NULL;
+    size_t *waves = NULL;
+    size_t i, j, k;
+    int ret = -1;
+
+    free(sched->order);
+    free(sched->wave_starts);
+    sched->order = malloc(sizeof(*sched->order) * (n + 1));
+    sched->wave_starts = malloc(sizeof(*sched->wave_starts) * (n + 1));
+    deps = calloc(n * n + 1, sizeof(*deps));
+    done = calloc(n + 1, sizeof(*done));
+    topo = calloc(n + 1, sizeof(*topo));
+    waves = calloc(n + 1, sizeof(*waves));
+    if (!sched->order || !sched->wave_starts || !deps || !done || !topo ||
+        !waves)
+        goto out_free;
+
+    /* deps[i * n + j] is set when i has to run before j */
+    for (i = 0; i < n; ++i) {
+        sys = sched->systems + i;
+        sys_sched_add_deps(sched, deps, i, sys->reg->pre_deps, true);
+        sys_sched_add_deps(sched, deps, i, sys->reg->post_deps, false);
+    }
+
+    /* Topological order, ties going to the system added first */
+    for (k = 0; k < n; ++k) {
+        for (j = 0; j < n; ++j) {
+            if (done[j])
+                continue;
+            for (i = 0; i < n; ++i)
+                if (!done[i] && deps[i * n + j])
+                    break;
+            if (i == n)
+                break;
+        }
+        if (j == n) {
+            fprintf(stderr, "System dependencies have a cycle\n");
+            goto out_free;
+        }
+        done[j] = true;
+        topo[k] = j;
+    }
+
+    /* Each system goes in the wave after the last one it has to follow */
+    sched->n_waves = 0;
+    for (k = 0; k < n; ++k) {
+        j = topo[k];
+        for (i = 0; i < k; ++i) {
+            if (!deps[topo[i] * n + j] &&
+                !sys_sched_conflict(sched->systems + topo[i],
+                                    sched->systems + j))
+                continue;
+            if (waves[j] < waves[topo[i]] + 1)
+                waves[j] = waves[topo[i]] + 1;
+        }
+        if (sched->n_waves < waves[j] + 1)
+            sched->n_waves = waves[j] + 1;
+    }
+
+    /* The topological order is kept within each wave */
+    k = 0;
+    for (i = 0; i < sched->n_waves; ++i) {
+        sched->wave_starts[i] = k;
+        for (j = 0; j < n; ++j)
+            if (waves[topo[j]] == i)
+                sched->order[k++] = topo[j];
+    }
+    sched->wave_starts[sched->n_waves] = k;
+
+    ret = 0;
+
+out_free:
+    free(deps);
+    free(done);
+    free(topo);
+    free(waves);
+
+    return ret;
+}
+
+static void sys_sched_run(struct sys_sched *sched, struct sys_sched_sys *sys)
+{
+    const struct entity_pool *pool = sched->pool;
+    const struct entity_pool_archetype *arch;
+    struct decs *decs = sched->decs;
+    void *ctx[1 + ENTITY_POOL_MAX_COMPS];
+    uint64_t begin_ns, end_ns;
+    uint64_t first = 0, n = 0;
+    uint64_t eid;
+    size_t n_ctx = 0;
+    size_t i;
+
+    begin_ns = trace_now_ns();
+
+    if (sys->aux)
+        ctx[n_ctx++] = sys->aux;
+    for (i = 0; i < sys->n_comps; ++i)
+        ctx[n_ctx++] = decs->comps[sys->comp_ids[i]].data;
+
+    /* One extra pass past the last range flushes the last run */
+    for (i = 0; i <= pool->n_archetypes; ++i) {
+        arch = i < pool->n_archetypes ? pool->archetypes + i : NULL;
+        if (arch && arch->n &&
+            (arch->comp_mask & sys->comp_mask) == sys->comp_mask &&
+            !(arch->comp_mask & sys->icomp_mask)) {
+            if (n && first + n == arch->first) {
+                n += arch->n;
+                continue;
+            }
+        } else if (arch) {
+            continue;
+        }
+
+        if (n && sys->reg->flags & DECS_SYS_FLAG_BATCH) {
+            ((sys_sched_batch_func)sys->reg->func)(decs, first, n, ctx);
+        } else {
+            for (eid = first; eid < first + n; ++eid)
+                ((sys_sched_func)sys->reg->func)(decs, eid, ctx);
+        }
+
+        if (arch) {
+            first = arch->first;
+            n = arch->n;
+        }
+    }
+
+    end_ns = trace_now_ns();
+    sys->last_ns = end_ns - begin_ns;
+    sys->total_ns += sys->last_ns;
+    if (__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED))
+        trace_record(sys->reg->name, begin_ns, end_ns);
+}
+
+static void sys_sched_run_chunk(void *data, size_t first, size_t n)
+{
+    struct sys_sched_job *job = data;
+    size_t i;
+
+    for (i = first; i < first + n; ++i)
+        sys_sched_run(job->sched, job->sched->systems + job->systems[i]);
+}
+
+void sys_sched_tick(struct sys_sched *sched, struct thread_pool *pool)
+{
+    struct sys_sched_job job = { sched };
+    size_t i, n;
+
+    for (i = 0; i < sched->n_waves; ++i) {
+        job.systems = sched->order + sched->wave_starts[i];
+        n = sched->wave_starts[i + 1] - sched->wave_starts[i];
+
+        if (n == 1)
+            sys_sched_run(sched, sched->systems + job.systems[0]);
+        else
+            thread_pool_run(pool, sys_sched_run_chunk, &job, n, 1);
+    }
+}
+
+void sys_sched_cleanup(struct sys_sched *sched)
+{
+    free(sched->systems);
+    free(sched->order);
+    free(sched->wave_starts);
+}
@@ -0,0 +1,83 @@
+#ifndef SYS_SCHED_H
+#define SYS_SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decs.h"
+#include "entity_pool.h"
+#include "thread_pool.h"
+
+/*
+ * Parallel tick of the systems registered with decs, run in place of
+ * decs_tick(). The systems are ordered by their pre_deps and post_deps and
+ * then grouped into waves, a system going into the wave after the last one
+ * holding a system it depends on or conflicts with. The systems of a wave run
+ * at the same time, one per thread of the pool.
+ *
+ * Two systems conflict when either one writes a component the other one
+ * uses, or when they share an aux context. Every component in comps is taken
+ * to be written unless it's listed in the reads of the system. Systems whose
+ * icomps exclude all of the entities of the other one never meet the same
+ * entity and don't conflict over the components. Of two conflicting systems
+ * with no dependency between them the one added first runs first.
+ *
+ * The systems are run over the archetype ranges of the entity pool, a batch
+ * system being called once per run of adjacent ranges it matches. The
+ * func_data they get is laid out like the one of decs_tick(): the aux context
+ * if there is one, followed by the bases of the comps arrays.
+ *
+ * A batch system which splits its range over the thread pool gets the whole
+ * pool when it's alone in its wave, otherwise its thread_pool_run() runs on
+ * the thread the system was given.
+ */
+
+struct sys_sched_sys {
+    const struct system_reg *reg;
+    void *aux;
+    uint64_t comp_ids[ENTITY_POOL_MAX_COMPS];
+    size_t n_comps;
+    uint64_t comp_mask;
+    uint64_t icomp_mask;
+    uint64_t write_mask;
+
+    /* Wall clock time of the system, in nanoseconds */
+    uint64_t last_ns;
+    uint64_t total_ns;
+};
+
+struct sys_sched {
+    struct decs *decs;
+    struct entity_pool *pool;
+
+    /* In the order they were added */
+    struct sys_sched_sys *systems;
+    size_t n_systems;
+    size_t n_allocd_systems;
+
+    /* Indices of the systems a wave after the other, set by the build */
+    size_t *order;
+    size_t *wave_starts; /* n_waves + 1 offsets into order */
+    size_t n_waves;
+};
+
+void sys_sched_init(struct sys_sched *sched, struct decs *decs,
+                    struct entity_pool *pool);
+
+/*
+ * Adds a system with the same aux context it was registered to decs with.
+ * reads is a STR_ARR() of the comps the system only reads, or NULL. The
+ * components have to have been registered through the pool.
+ */
+int sys_sched_add(struct sys_sched *sched, const struct system_reg *reg,
+                  void *aux, const char **reads);
+
+/* Orders the systems into waves, to be called once all of them are added */
+int sys_sched_build(struct sys_sched *sched);
+
+/* Runs every system once, a NULL pool runs the waves serially */
+void sys_sched_tick(struct sys_sched *sched, struct thread_pool *pool);
+
+void sys_sched_cleanup(struct sys_sched *sched);
+
+#endif
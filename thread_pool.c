@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "trace.h"
+
+/*
+ * Claims and processes chunks of the current job until it runs out. Called
+ * and returns with the lock held. The chunks of the workers are traced, the
+ * ones of the submitting thread are covered by the spans of its caller.
+ */
+static void thread_pool_work(struct thread_pool *pool, bool worker)
+{
+    thread_pool_func func = pool->func;
+    void *data = pool->data;
+    uint64_t span_start;
+    size_t first;
+    size_t n;
+
+    while (pool->next_item < pool->n_items) {
+        first = pool->next_item;
+        n = pool->n_items - first;
+        if (n > pool->chunk_size)
+            n = pool->chunk_size;
+        pool->next_item += n;
+
+        pthread_mutex_unlock(&pool->lock);
+        span_start = worker ? trace_begin() : 0;
+        func(data, first, n);
+        trace_end("thread_pool_chunk", span_start);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->n_done_items += n;
+        if (pool->n_done_items == pool->n_items)
+            pthread_cond_broadcast(&pool->done_cond);
+    }
+}
+
+static void *thread_pool_worker(void *arg)
+{
+    struct thread_pool *pool = arg;
+    unsigned long generation = 0;
+
+    trace_set_thread_name("thread_pool worker");
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == generation)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->quit)
+            break;
+
+        generation = pool->generation;
+        thread_pool_work(pool, true);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int thread_pool_init(struct thread_pool *pool, unsigned n_threads)
+{
+    long n_cpus;
+    unsigned i;
+    int err;
+
+    memset(pool, 0, sizeof(*pool));
+
+    if (!n_threads) {
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? n_cpus : 1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    pool->threads = calloc(n_threads, sizeof(*pool->threads));
+    if (!pool->threads)
+        return -1;
+
+    for (i = 0; i + 1 < n_threads; ++i) {
+        err = pthread_create(&pool->threads[i], NULL, thread_pool_worker,
+                             pool);
+        if (err) {
+            fprintf(stderr, "Creating worker thread failed: %s\n",
+                    strerror(err));
+            ++pool->n_threads;
+            thread_pool_cleanup(pool);
+            return -1;
+        }
+        ++pool->n_threads;
+    }
+    ++pool->n_threads; /* The submitting thread */
+
+    return 0;
+}
+
+void thread_pool_run(struct thread_pool *pool, thread_pool_func func,
+                     void *data, size_t n_items, size_t chunk_size)
+{
+    if (!n_items)
+        return;
+
+    if (!pool || pool->n_threads <= 1 || n_items <= chunk_size) {
+        func(data, 0, n_items);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->busy) {
+        pthread_mutex_unlock(&pool->lock);
+        func(data, 0, n_items);
+        return;
+    }
+
+    pool->busy = true;
+    pool->func = func;
+    pool->data = data;
+    pool->n_items = n_items;
+    pool->chunk_size = chunk_size ? chunk_size : 1;
+    pool->next_item = 0;
+    pool->n_done_items = 0;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->work_cond);
+
+    thread_pool_work(pool, false);
+    while (pool->n_done_items < pool->n_items)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pool->busy = false;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_cleanup(struct thread_pool *pool)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i + 1 < pool->n_threads; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+}
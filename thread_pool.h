@@ -0,0 +1,53 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* Processes items [first, first + n) of the job */
+typedef void (*thread_pool_func)(void *data, size_t first, size_t n);
+
+/*
+ * Persistent pool of worker threads for data parallel jobs. A job is a range
+ * of items that is split into chunks, the workers and the submitting thread
+ * claim chunks until the whole range has been processed.
+ */
+struct thread_pool {
+    pthread_t *threads;
+    unsigned n_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+
+    /* The current job, protected by lock */
+    thread_pool_func func;
+    void *data;
+    size_t n_items;
+    size_t chunk_size;
+    size_t next_item;
+    size_t n_done_items;
+    unsigned long generation;
+    bool busy;
+    bool quit;
+};
+
+/*
+ * Spawns n_threads - 1 workers, the thread calling thread_pool_run() being
+ * the last one. Zero picks the number of online CPUs.
+ */
+int thread_pool_init(struct thread_pool *pool, unsigned n_threads);
+
+/*
+ * Runs func over n_items in chunks of chunk_size items and returns once all of
+ * them have been processed. A NULL pool runs the whole range on the calling
+ * thread, as does a pool which is already running a job, e.g. when called
+ * from one of its chunks.
+ */
+void thread_pool_run(struct thread_pool *pool, thread_pool_func func,
+                     void *data, size_t n_items, size_t chunk_size);
+
+void thread_pool_cleanup(struct thread_pool *pool);
+
+#endif
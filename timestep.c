@@ -0,0 +1,30 @@
+#include "timestep.h"
+
+void timestep_init(struct timestep *ts, double dt, unsigned max_substeps)
+{
+    ts->dt = dt;
+    ts->accumulator = 0.0;
+    ts->max_substeps = max_substeps;
+}
+
+unsigned timestep_advance(struct timestep *ts, double frame_time)
+{
+    unsigned n_steps = 0;
+
+    ts->accumulator += frame_time;
+
+    while (ts->accumulator >= ts->dt && n_steps < ts->max_substeps) {
+        ts->accumulator -= ts->dt;
+        ++n_steps;
+    }
+
+    if (ts->accumulator >= ts->dt)
+        ts->accumulator = 0.0;
+
+    return n_steps;
+}
+
+float timestep_alpha(const struct timestep *ts)
+{
+    return ts->accumulator / ts->dt;
+}
@@ -0,0 +1,28 @@
+#ifndef TIMESTEP_H
+#define TIMESTEP_H
+
+/*
+ * Fixed time step driver. The wall clock time of each frame is added to an
+ * accumulator which is consumed in steps of dt, so the simulation runs at
+ * the same speed regardless of the frame rate. At most max_substeps steps are
+ * run per frame, the time beyond that is dropped and the simulation slows
+ * down instead of falling further and further behind.
+ */
+struct timestep {
+    double dt;
+    double accumulator;
+    unsigned max_substeps;
+};
+
+void timestep_init(struct timestep *ts, double dt, unsigned max_substeps);
+
+/* Returns the number of steps to run for a frame that took frame_time */
+unsigned timestep_advance(struct timestep *ts, double frame_time);
+
+/*
+ * How far the current time is between the last two steps, in [0, 1), for
+ * interpolating the rendered state
+ */
+float timestep_alpha(const struct timestep *ts);
+
+#endif
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "trace.h"
+
+struct trace_ring {
+    struct trace_event events[TRACE_RING_SIZE];
+    /* Spans recorded, only written by the owner while tracing */
+    uint64_t head;
+    const char *thread_name;
+};
+
+bool trace_enabled;
+static uint64_t trace_start_ns;
+
+/* Registered with an atomic increment, a slot is NULL until it's published */
+static struct trace_ring *trace_rings[TRACE_MAX_THREADS];
+static unsigned trace_n_rings;
+
+static __thread struct trace_ring *trace_ring;
+static __thread bool trace_no_ring;
+static __thread const char *trace_thread_name;
+
+uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static struct trace_ring *trace_ring_create(void)
+{
+    struct trace_ring *ring;
+    unsigned idx;
+
+    idx = __atomic_fetch_add(&trace_n_rings, 1, __ATOMIC_RELAXED);
+    if (idx >= TRACE_MAX_THREADS)
+        return NULL;
+
+    ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    ring->thread_name = trace_thread_name;
+
+    __atomic_store_n(&trace_rings[idx], ring, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+void trace_record(const char *name, uint64_t begin_ns, uint64_t end_ns)
+{
+    struct trace_event *event;
+
+    if (!trace_ring) {
+        if (trace_no_ring)
+            return;
+        trace_ring = trace_ring_create();
+        if (!trace_ring) {
+            trace_no_ring = true;
+            return;
+        }
+    }
+
+    event = trace_ring->events + trace_ring->head % TRACE_RING_SIZE;
+    event->name = name;
+    event->begin_ns = begin_ns;
+    event->end_ns = end_ns;
+
+    __atomic_store_n(&trace_ring->head, trace_ring->head + 1,
+                     __ATOMIC_RELEASE);
+}
+
+void trace_set_thread_name(const char *name)
+{
+    trace_thread_name = name;
+    if (trace_ring)
+        trace_ring->thread_name = name;
+}
+
+static unsigned trace_n_slots(void)
+{
+    unsigned n = __atomic_load_n(&trace_n_rings, __ATOMIC_ACQUIRE);
+
+    return n < TRACE_MAX_THREADS ? n : TRACE_MAX_THREADS;
+}
+
+void trace_start(void)
+{
+    unsigned n_slots = trace_n_slots();
+    struct trace_ring *ring;
+    unsigned i;
+
+    for (i = 0; i < n_slots; ++i) {
+        ring = __atomic_load_n(&trace_rings[i], __ATOMIC_ACQUIRE);
+        if (ring)
+            __atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+    }
+
+    trace_start_ns = trace_now_ns();
+    __atomic_store_n(&trace_enabled, true, __ATOMIC_RELEASE);
+}
+
+void trace_stop(void)
+{
+    __atomic_store_n(&trace_enabled, false, __ATOMIC_RELEASE);
+}
+
+/* The names are C identifiers in practice, quotes and backslashes escaped */
+static void trace_write_str(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; s && *s; ++s) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        if ((unsigned char)*s >= ' ')
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/* Complete events in microseconds, plus a metadata event naming the thread */
+static void trace_write_ring(FILE *f, const struct trace_ring *ring,
+                             unsigned tid, bool *first)
+{
+    const struct trace_event *event;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+    if (ring->thread_name) {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":", *first ? "" : ",", tid);
+        trace_write_str(f, ring->thread_name);
+        fputs("}}", f);
+        *first = false;
+    }
+
+    for (; i < head; ++i) {
+        event = ring->events + i % TRACE_RING_SIZE;
+        if (event->begin_ns < trace_start_ns)
+            continue;
+
+        fprintf(f, "%s\n{\"name\":", *first ? "" : ",");
+        trace_write_str(f, event->name);
+        fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+                "\"dur\":%.3f}", tid,
+                (event->begin_ns - trace_start_ns) / 1e3,
+                (event->end_ns - event->begin_ns) / 1e3);
+        *first = false;
+    }
+}
+
+int trace_dump(const char *path)
+{
+    unsigned n_slots = trace_n_slots();
+    struct trace_ring *ring;
+    bool first = true;
+    unsigned i;
+    FILE *f;
+
+    f = fopen(path, "w");
+    if (!f) {
+        perror("Opening trace failed");
+        return -1;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+    for (i = 0; i < n_slots; ++i) {
+        ring = __atomic_load_n(&trace_rings[i], __ATOMIC_ACQUIRE);
+        if (ring)
+            trace_write_ring(f, ring, i, &first);
+    }
+    fputs("\n]}\n", f);
+
+    if (ferror(f) | fclose(f)) {
+        perror("Writing trace failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The threads which recorded spans have to be done with them */
+void trace_cleanup(void)
+{
+    unsigned n_slots = trace_n_slots();
+    unsigned i;
+
+    trace_stop();
+    for (i = 0; i < n_slots; ++i) {
+        free(trace_rings[i]);
+        trace_rings[i] = NULL;
+    }
+    trace_n_rings = 0;
+    trace_ring = NULL;
+}
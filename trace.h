@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Spans kept per thread, the oldest ones are overwritten past this */
+#define TRACE_RING_SIZE (1 << 16)
+#define TRACE_MAX_THREADS 64
+
+/*
+ * Timeline tracing. Spans are recorded into a ring buffer owned by the
+ * recording thread, allocated on its first span, so recording takes no locks.
+ * The rings are written out as Chrome trace event JSON, which can be opened
+ * in chrome://tracing or Perfetto.
+ *
+ * Names are stored as pointers and have to stay valid until the dump. While
+ * tracing is stopped a span costs a flag check.
+ */
+
+struct trace_event {
+    const char *name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+extern bool trace_enabled;
+
+/* CLOCK_MONOTONIC time, in nanoseconds */
+uint64_t trace_now_ns(void);
+
+void trace_record(const char *name, uint64_t begin_ns, uint64_t end_ns);
+
+/* Returns the start of a span to be passed to trace_end(), zero if stopped */
+static inline uint64_t trace_begin(void)
+{
+    return __atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) ?
+           trace_now_ns() : 0;
+}
+
+static inline void trace_end(const char *name, uint64_t begin_ns)
+{
+    if (begin_ns)
+        trace_record(name, begin_ns, trace_now_ns());
+}
+
+/* Names the calling thread in the dumps */
+void trace_set_thread_name(const char *name);
+
+/*
+ * Starting drops the spans recorded so far. Starting, stopping and dumping
+ * have to be done while no other thread is recording, e.g. between ticks.
+ */
+void trace_start(void);
+void trace_stop(void);
+
+/* Writes the spans in the rings to path */
+int trace_dump(const char *path);
+
+void trace_cleanup(void);
+
+#endif
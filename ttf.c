@@ -1,4 +1,7 @@
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
@@ -32,6 +35,133 @@ enum {
     VA_IDX_TEX_POS,
 };
 
+/*
+ * Glyph atlas. The printable ASCII glyphs are rasterised once into a single
+ * texture, strings are turned into textured quads which are collected over
+ * the frame and drawn with one call in ttf_flush(). If the atlas can't be
+ * built, every string is rasterised and drawn on its own as before.
+ */
+#define TTF_FIRST_GLYPH ' '
+#define TTF_LAST_GLYPH '~'
+#define TTF_N_GLYPHS (TTF_LAST_GLYPH - TTF_FIRST_GLYPH + 1)
+#define TTF_ATLAS_W 512
+
+/* Strings up to this long are formatted on the stack */
+#define TTF_PRINTF_BUF_SIZE 256
+
+struct ttf_glyph {
+    float u0, v0, u1, v1;
+    int w, h;
+    int advance;
+};
+
+struct ttf_vert {
+    GLfloat x, y;
+    GLfloat u, v;
+};
+
+static bool atlas;
+static GLuint atlas_tex_id;
+static struct ttf_glyph glyphs[TTF_N_GLYPHS];
+
+static GLuint batch_vao_id;
+static GLuint batch_vbo_id;
+static struct ttf_vert *batch_verts;
+static size_t n_batch_verts;
+static size_t n_allocd_batch_verts;
+
+/* Reused by ttf_printf() for strings that don't fit the stack buffer */
+static char *fmt_buf;
+static size_t fmt_buf_size;
+
+/*
+ * Shelf packing, the glyphs are placed left to right and a new row is started
+ * when the current one is full. The surfaces are 32 bit ARGB, uploaded as
+ * RGBA like the per string ones.
+ */
+static int ttf_build_atlas(void)
+{
+    const SDL_Color color = {255, 255, 255, 0};
+    SDL_Surface *surfs[TTF_N_GLYPHS];
+    int xs[TTF_N_GLYPHS], ys[TTF_N_GLYPHS];
+    int x = 0, y = 0, row_h = 0, atlas_h;
+    uint32_t *pixels;
+    int minx, maxx, miny, maxy;
+    int i, j, row;
+    int ret = -1;
+
+    memset(surfs, 0, sizeof(surfs));
+
+    for (i = 0; i < TTF_N_GLYPHS; ++i) {
+        surfs[i] = TTF_RenderGlyph_Blended(font, TTF_FIRST_GLYPH + i, color);
+        if (!surfs[i] || surfs[i]->w > TTF_ATLAS_W)
+            goto out_free;
+        if (TTF_GlyphMetrics(font, TTF_FIRST_GLYPH + i, &minx, &maxx, &miny,
+                             &maxy, &glyphs[i].advance))
+            goto out_free;
+
+        if (x + surfs[i]->w > TTF_ATLAS_W) {
+            x = 0;
+            y += row_h;
+            row_h = 0;
+        }
+        xs[i] = x;
+        ys[i] = y;
+        x += surfs[i]->w;
+        if (surfs[i]->h > row_h)
+            row_h = surfs[i]->h;
+    }
+    atlas_h = y + row_h;
+
+    pixels = calloc(TTF_ATLAS_W * atlas_h, sizeof(*pixels));
+    if (!pixels)
+        goto out_free;
+
+    for (i = 0; i < TTF_N_GLYPHS; ++i) {
+        for (row = 0; row < surfs[i]->h; ++row)
+            memcpy(pixels + (ys[i] + row) * TTF_ATLAS_W + xs[i],
+                   (char *)surfs[i]->pixels + row * surfs[i]->pitch,
+                   surfs[i]->w * sizeof(*pixels));
+
+        glyphs[i].w = surfs[i]->w;
+        glyphs[i].h = surfs[i]->h;
+        glyphs[i].u0 = xs[i] / (float)TTF_ATLAS_W;
+        glyphs[i].v0 = ys[i] / (float)atlas_h;
+        glyphs[i].u1 = (xs[i] + surfs[i]->w) / (float)TTF_ATLAS_W;
+        glyphs[i].v1 = (ys[i] + surfs[i]->h) / (float)atlas_h;
+    }
+
+    glGenTextures(1, &atlas_tex_id);
+    glBindTexture(GL_TEXTURE_2D, atlas_tex_id);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TTF_ATLAS_W, atlas_h, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, pixels);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    free(pixels);
+
+    glGenVertexArrays(1, &batch_vao_id);
+    glBindVertexArray(batch_vao_id);
+    glGenBuffers(1, &batch_vbo_id);
+    glBindBuffer(GL_ARRAY_BUFFER, batch_vbo_id);
+    glVertexAttribPointer(VA_IDX_VERT_POS, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(struct ttf_vert),
+                          (void *)offsetof(struct ttf_vert, x));
+    glVertexAttribPointer(VA_IDX_TEX_POS, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(struct ttf_vert),
+                          (void *)offsetof(struct ttf_vert, u));
+
+    ret = 0;
+
+out_free:
+    for (j = 0; j < TTF_N_GLYPHS; ++j)
+        if (surfs[j])
+            SDL_FreeSurface(surfs[j]);
+
+    return ret;
+}
+
 int ttf_init(SDL_Renderer *renderer, SDL_Window *window, const char *font_path)
 {
     TTF_Init();
@@ -82,14 +212,99 @@ int ttf_init(SDL_Renderer *renderer, SDL_Window *window, const char *font_path)
     glBufferData(GL_ARRAY_BUFFER, sizeof(tex_coords), tex_coords,
                  GL_STATIC_DRAW);
 
+    atlas = !ttf_build_atlas();
+
     return 0;
 }
 
+static struct ttf_vert *ttf_batch_alloc(size_t n)
+{
+    struct ttf_vert *verts;
+
+    if (n_batch_verts + n > n_allocd_batch_verts) {
+        if (!n_allocd_batch_verts)
+            n_allocd_batch_verts = 1024;
+        while (n_batch_verts + n > n_allocd_batch_verts)
+            n_allocd_batch_verts *= 2;
+        batch_verts = realloc(batch_verts, sizeof(*batch_verts) *
+                                           n_allocd_batch_verts);
+    }
+
+    verts = batch_verts + n_batch_verts;
+    n_batch_verts += n;
+
+    return verts;
+}
+
+/* Two triangles per glyph, characters outside the atlas are skipped */
+static void ttf_batch_string(unsigned x, unsigned y, const char *str)
+{
+    const struct ttf_glyph *g;
+    struct ttf_vert *v;
+    float x0, y0, x1, y1;
+    unsigned char c;
+
+    for (; (c = *str); ++str) {
+        if (c < TTF_FIRST_GLYPH || c > TTF_LAST_GLYPH)
+            continue;
+        g = &glyphs[c - TTF_FIRST_GLYPH];
+
+        x0 = x;
+        y0 = y;
+        x1 = x + g->w;
+        y1 = y + g->h;
+
+        v = ttf_batch_alloc(6);
+        v[0] = (struct ttf_vert) { x0, y0, g->u0, g->v0 };
+        v[1] = (struct ttf_vert) { x1, y0, g->u1, g->v0 };
+        v[2] = (struct ttf_vert) { x0, y1, g->u0, g->v1 };
+        v[3] = (struct ttf_vert) { x0, y1, g->u0, g->v1 };
+        v[4] = (struct ttf_vert) { x1, y0, g->u1, g->v0 };
+        v[5] = (struct ttf_vert) { x1, y1, g->u1, g->v1 };
+
+        x += g->advance;
+    }
+}
+
+void ttf_flush(void)
+{
+    if (!n_batch_verts)
+        return;
+
+    glBindVertexArray(batch_vao_id);
+    glBindBuffer(GL_ARRAY_BUFFER, batch_vbo_id);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(*batch_verts) * n_batch_verts,
+                 batch_verts, GL_STREAM_DRAW);
+
+    glBindTexture(GL_TEXTURE_2D, atlas_tex_id);
+
+    glEnableVertexAttribArray(VA_IDX_VERT_POS);
+    glEnableVertexAttribArray(VA_IDX_TEX_POS);
+
+    glUseProgram(shader_prog_id);
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glDrawArrays(GL_TRIANGLES, 0, n_batch_verts);
+
+    glDisableVertexAttribArray(VA_IDX_VERT_POS);
+    glDisableVertexAttribArray(VA_IDX_TEX_POS);
+
+    n_batch_verts = 0;
+}
+
 void ttf_render(unsigned x, unsigned y, const char *str)
 {
     SDL_Surface *surf;
     SDL_Color color = {255, 255, 255, 0};
 
+    if (atlas) {
+        ttf_batch_string(x, y, str);
+        return;
+    }
+
     surf = TTF_RenderText_Blended(font, str, color);
 
     glBindTexture(GL_TEXTURE_2D, tex_id);
@@ -137,20 +352,26 @@ void ttf_render(unsigned x, unsigned y, const char *str)
 int ttf_printf(unsigned x, unsigned y, const char *fmt, ...)
 {
     va_list sz_vargs, vargs;
+    char stack_buf[TTF_PRINTF_BUF_SIZE];
+    char *buf = stack_buf;
     int sz;
-    char *buf;
 
     va_start(sz_vargs, fmt);
     va_copy(vargs, sz_vargs);
-    sz = vsnprintf(NULL, 0, fmt, sz_vargs) + 1;
+    sz = vsnprintf(stack_buf, sizeof(stack_buf), fmt, sz_vargs);
     va_end(sz_vargs);
 
-    buf = malloc(sz);
-    sz = vsnprintf(buf, sz, fmt, vargs);
+    if (sz >= (int)sizeof(stack_buf)) {
+        if (sz + 1 > fmt_buf_size) {
+            fmt_buf_size = sz + 1;
+            fmt_buf = realloc(fmt_buf, fmt_buf_size);
+        }
+        buf = fmt_buf;
+        sz = vsnprintf(buf, fmt_buf_size, fmt, vargs);
+    }
     va_end(vargs);
 
     ttf_render(x, y, buf);
-    free(buf);
 
     return sz;
 }
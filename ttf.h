@@ -6,4 +6,7 @@ int ttf_init(SDL_Renderer *renderer, SDL_Window *window, const char *font_path);
 void ttf_render(unsigned x, unsigned y, const char *str);
 int ttf_printf(unsigned x, unsigned y, const char *fmt, ...);
 
+/* Draws the strings rendered since the last flush, once per frame */
+void ttf_flush(void);
+
 #endif
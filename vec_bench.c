@@ -0,0 +1,279 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "vec3.h"
+#include "vec_simd.h"
+
+#define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+/*
+ * Vector math microbenchmark. Each operation is timed over n vectors with the
+ * by-value vec3.h helpers on an array of struct vec3 and with the vec_simd.h
+ * array operations on the same values, as SoA streams where the operation
+ * needs them. Printed as CSV are the times per vector and the largest
+ * absolute difference from the vec3.h results.
+ *
+ * Usage: vec_bench [vectors] [passes]
+ */
+
+struct bench_data {
+    size_t n;
+    struct vec3 *a, *b, *out;
+    float *ax, *ay, *az;
+    float *bx, *by, *bz;
+    float *sx, *sy, *sz;
+    float *dots;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static float randf(float min, float max)
+{
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+/* Keeps the results of a pass alive */
+static volatile float sink;
+
+static void scalar_add(struct bench_data *d)
+{
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        d->out[i] = vec3_add(d->a[i], d->b[i]);
+    sink = d->out[d->n - 1].x;
+}
+
+static void simd_add(struct bench_data *d)
+{
+    vec_simd_add(d->out[0].e, d->a[0].e, d->b[0].e, 3 * d->n);
+    sink = d->out[d->n - 1].x;
+}
+
+static void scalar_scale(struct bench_data *d)
+{
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        d->out[i] = vec3_muls(d->a[i], 1.5f);
+    sink = d->out[d->n - 1].x;
+}
+
+static void simd_scale(struct bench_data *d)
+{
+    vec_simd_scale(d->out[0].e, d->a[0].e, 1.5f, 3 * d->n);
+    sink = d->out[d->n - 1].x;
+}
+
+static void scalar_dot(struct bench_data *d)
+{
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        d->dots[i] = vec3_dot(d->a[i], d->b[i]);
+    sink = d->dots[d->n - 1];
+}
+
+static void simd_dot(struct bench_data *d)
+{
+    vec3_soa_dot(d->dots, d->ax, d->ay, d->az, d->bx, d->by, d->bz, d->n);
+    sink = d->dots[d->n - 1];
+}
+
+static void scalar_norm(struct bench_data *d)
+{
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        d->dots[i] = vec3_norm(d->a[i]);
+    sink = d->dots[d->n - 1];
+}
+
+static void simd_norm(struct bench_data *d)
+{
+    vec3_soa_norm(d->dots, d->ax, d->ay, d->az, d->n);
+    sink = d->dots[d->n - 1];
+}
+
+static void scalar_normalize(struct bench_data *d)
+{
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        d->out[i] = vec3_normalize(d->a[i]);
+    sink = d->out[d->n - 1].x;
+}
+
+static void simd_normalize(struct bench_data *d)
+{
+    vec3_soa_normalize(d->sx, d->sy, d->sz, d->ax, d->ay, d->az, d->n);
+    sink = d->sx[d->n - 1];
+}
+
+/* Largest errors of the SIMD results against the vec3.h ones */
+
+static double add_error(const struct bench_data *d)
+{
+    double err = 0.0;
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        err = fmax(err, vec3_norm(vec3_sub(d->out[i],
+                                           vec3_add(d->a[i], d->b[i]))));
+
+    return err;
+}
+
+static double scale_error(const struct bench_data *d)
+{
+    double err = 0.0;
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        err = fmax(err, vec3_norm(vec3_sub(d->out[i],
+                                           vec3_muls(d->a[i], 1.5f))));
+
+    return err;
+}
+
+static double dot_error(const struct bench_data *d)
+{
+    double err = 0.0;
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        err = fmax(err, fabsf(d->dots[i] - vec3_dot(d->a[i], d->b[i])));
+
+    return err;
+}
+
+static double norm_error(const struct bench_data *d)
+{
+    double err = 0.0;
+    size_t i;
+
+    for (i = 0; i < d->n; ++i)
+        err = fmax(err, fabsf(d->dots[i] - vec3_norm(d->a[i])));
+
+    return err;
+}
+
+static double normalize_error(const struct bench_data *d)
+{
+    struct vec3 v;
+    double err = 0.0;
+    size_t i;
+
+    for (i = 0; i < d->n; ++i) {
+        v = (struct vec3) { d->sx[i], d->sy[i], d->sz[i] };
+        err = fmax(err, vec3_norm(vec3_sub(v, vec3_normalize(d->a[i]))));
+    }
+
+    return err;
+}
+
+static const struct {
+    const char *op;
+    void (*scalar)(struct bench_data *d);
+    void (*simd)(struct bench_data *d);
+    double (*error)(const struct bench_data *d);
+} ops[] = {
+    { "add",        scalar_add,       simd_add,       add_error },
+    { "scale",      scalar_scale,     simd_scale,     scale_error },
+    { "dot",        scalar_dot,       simd_dot,       dot_error },
+    { "norm",       scalar_norm,      simd_norm,      norm_error },
+    { "normalize",  scalar_normalize, simd_normalize, normalize_error },
+};
+
+static double time_op(void (*func)(struct bench_data *d),
+                      struct bench_data *d, unsigned n_passes)
+{
+    double start;
+    unsigned pass;
+
+    func(d); /* Warm up */
+
+    start = now_ns();
+    for (pass = 0; pass < n_passes; ++pass)
+        func(d);
+
+    return (now_ns() - start) / ((double)n_passes * d->n);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_data d;
+    unsigned n_passes = 2000;
+    double scalar_ns, simd_ns;
+    size_t i;
+    int ret = EXIT_SUCCESS;
+
+    d.n = 4096;
+    if (argc > 1)
+        d.n = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        n_passes = strtoul(argv[2], NULL, 0);
+
+    if (!d.n || !n_passes) {
+        fprintf(stderr, "Vector and pass counts have to be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    d.a = malloc(sizeof(*d.a) * d.n);
+    d.b = malloc(sizeof(*d.b) * d.n);
+    d.out = malloc(sizeof(*d.out) * d.n);
+    d.ax = malloc(sizeof(float) * d.n * 10);
+    if (!d.a || !d.b || !d.out || !d.ax) {
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+    d.ay = d.ax + d.n;
+    d.az = d.ay + d.n;
+    d.bx = d.az + d.n;
+    d.by = d.bx + d.n;
+    d.bz = d.by + d.n;
+    d.sx = d.bz + d.n;
+    d.sy = d.sx + d.n;
+    d.sz = d.sy + d.n;
+    d.dots = d.sz + d.n;
+
+    srand(1);
+    for (i = 0; i < d.n; ++i) {
+        d.a[i] = (struct vec3) {
+            randf(-1.0f, 1.0f), randf(-1.0f, 1.0f), randf(0.1f, 1.0f)
+        };
+        d.b[i] = (struct vec3) {
+            randf(-1.0f, 1.0f), randf(-1.0f, 1.0f), randf(-1.0f, 1.0f)
+        };
+        d.ax[i] = d.a[i].x, d.ay[i] = d.a[i].y, d.az[i] = d.a[i].z;
+        d.bx[i] = d.b[i].x, d.by[i] = d.b[i].y, d.bz[i] = d.b[i].z;
+    }
+
+    printf("op,isa,vec3_ns_per_vec,simd_ns_per_vec,speedup,max_err\n");
+    for (i = 0; i < ARRAY_SIZE(ops); ++i) {
+        scalar_ns = time_op(ops[i].scalar, &d, n_passes);
+        simd_ns = time_op(ops[i].simd, &d, n_passes);
+        printf("%s,%s,%.3f,%.3f,%.2f,%g\n", ops[i].op, VEC_SIMD_ISA,
+               scalar_ns, simd_ns, scalar_ns / simd_ns,
+               ops[i].error(&d));
+    }
+
+out:
+    free(d.a);
+    free(d.b);
+    free(d.out);
+    free(d.ax);
+
+    return ret;
+}
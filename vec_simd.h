@@ -0,0 +1,544 @@
+#ifndef VEC_SIMD_H
+#define VEC_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "vec3.h"
+
+/*
+ * Packed counterparts of the vec3.h helpers. The implementation is picked at
+ * compile time from the target instruction set: AVX, SSE2 or plain C, which
+ * can also be forced with VEC_SIMD_SCALAR.
+ *
+ * struct vec4 is a 16 byte aligned vec3 with a pad lane, the same layout as
+ * the vec3 triples loaded by phys_kernels. struct vec3x4 and vec3x8 are 4 and
+ * 8 vec3s in SoA form, one register per coordinate. The array operations at
+ * the end work on spans of floats or of SoA coordinate streams.
+ */
+
+#if defined(VEC_SIMD_SCALAR)
+#define VEC_SIMD_ISA "scalar"
+#elif defined(__AVX__)
+#define VEC_SIMD_AVX
+#define VEC_SIMD_SSE
+#define VEC_SIMD_ISA "avx"
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define VEC_SIMD_SSE
+#define VEC_SIMD_ISA "sse2"
+#include <emmintrin.h>
+#else
+#define VEC_SIMD_ISA "scalar"
+#endif
+
+#ifdef VEC_SIMD_SSE
+typedef __m128 vec_f4;
+#else
+typedef struct {
+    float e[4];
+} vec_f4;
+#endif
+
+#ifdef VEC_SIMD_AVX
+typedef __m256 vec_f8;
+#else
+typedef struct {
+    vec_f4 lo, hi;
+} vec_f8;
+#endif
+
+struct vec4 {
+    union {
+        float e[4];
+        struct {
+            float x, y, z, w;
+        };
+    };
+} __attribute__((aligned(16)));
+
+struct vec3x4 {
+    vec_f4 x, y, z;
+};
+
+struct vec3x8 {
+    vec_f8 x, y, z;
+};
+
+/* Four lane primitives */
+
+static inline vec_f4 vec_f4_set1(float a)
+{
+#ifdef VEC_SIMD_SSE
+    return _mm_set1_ps(a);
+#else
+    return (vec_f4) {{ a, a, a, a }};
+#endif
+}
+
+static inline vec_f4 vec_f4_set(float a, float b, float c, float d)
+{
+#ifdef VEC_SIMD_SSE
+    return _mm_setr_ps(a, b, c, d);
+#else
+    return (vec_f4) {{ a, b, c, d }};
+#endif
+}
+
+static inline vec_f4 vec_f4_load(const float *p)
+{
+#ifdef VEC_SIMD_SSE
+    return _mm_loadu_ps(p);
+#else
+    return (vec_f4) {{ p[0], p[1], p[2], p[3] }};
+#endif
+}
+
+static inline void vec_f4_store(float *p, vec_f4 a)
+{
+#ifdef VEC_SIMD_SSE
+    _mm_storeu_ps(p, a);
+#else
+    p[0] = a.e[0], p[1] = a.e[1], p[2] = a.e[2], p[3] = a.e[3];
+#endif
+}
+
+#ifdef VEC_SIMD_SSE
+#define VEC_F4_OP(name, sse, op)                                            \
+static inline vec_f4 vec_f4_##name(vec_f4 a, vec_f4 b)                     \
+{                                                                           \
+    return sse(a, b);                                                       \
+}
+#else
+#define VEC_F4_OP(name, sse, op)                                            \
+static inline vec_f4 vec_f4_##name(vec_f4 a, vec_f4 b)                     \
+{                                                                           \
+    return (vec_f4) {{ a.e[0] op b.e[0], a.e[1] op b.e[1],                  \
+                       a.e[2] op b.e[2], a.e[3] op b.e[3] }};               \
+}
+#endif
+
+VEC_F4_OP(add, _mm_add_ps, +)
+VEC_F4_OP(sub, _mm_sub_ps, -)
+VEC_F4_OP(mul, _mm_mul_ps, *)
+
+#undef VEC_F4_OP
+
+/* A bit per lane where a <= b, lane 0 being the lowest */
+static inline unsigned vec_f4_le(vec_f4 a, vec_f4 b)
+{
+#ifdef VEC_SIMD_SSE
+    return _mm_movemask_ps(_mm_cmple_ps(a, b));
+#else
+    return (a.e[0] <= b.e[0]) | (a.e[1] <= b.e[1]) << 1 |
+           (a.e[2] <= b.e[2]) << 2 | (a.e[3] <= b.e[3]) << 3;
+#endif
+}
+
+/*
+ * 1 / sqrt(a), the hardware estimate is good to 12 bits and a Newton step
+ * brings it to about 22
+ */
+static inline vec_f4 vec_f4_rsqrt(vec_f4 a)
+{
+#ifdef VEC_SIMD_SSE
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 three = _mm_set1_ps(3.0f);
+    __m128 r = _mm_rsqrt_ps(a);
+
+    return _mm_mul_ps(_mm_mul_ps(half, r),
+                      _mm_sub_ps(three, _mm_mul_ps(_mm_mul_ps(a, r), r)));
+#else
+    return (vec_f4) {{
+        1.0f / sqrtf(a.e[0]), 1.0f / sqrtf(a.e[1]),
+        1.0f / sqrtf(a.e[2]), 1.0f / sqrtf(a.e[3]),
+    }};
+#endif
+}
+
+static inline vec_f4 vec_f4_sqrt(vec_f4 a)
+{
+#ifdef VEC_SIMD_SSE
+    return _mm_sqrt_ps(a);
+#else
+    return (vec_f4) {{
+        sqrtf(a.e[0]), sqrtf(a.e[1]), sqrtf(a.e[2]), sqrtf(a.e[3]),
+    }};
+#endif
+}
+
+/*
+ * Stores the lanes rounded to the nearest integer and saturated to the range
+ * of the integer type, for packing normalised values
+ */
+static inline void vec_f4_store_u16(uint16_t *p, vec_f4 a)
+{
+#ifdef VEC_SIMD_SSE
+    /* There's no unsigned saturating pack before SSE4.1 */
+    __m128i i = _mm_sub_epi32(_mm_cvtps_epi32(a), _mm_set1_epi32(0x8000));
+
+    i = _mm_xor_si128(_mm_packs_epi32(i, i), _mm_set1_epi16(-0x8000));
+    _mm_storel_epi64((__m128i *)p, i);
+#else
+    float x;
+    int j;
+
+    for (j = 0; j < 4; ++j) {
+        x = rintf(a.e[j]);
+        p[j] = x > 0.0f ? (x < 65535.0f ? x : 65535.0f) : 0.0f;
+    }
+#endif
+}
+
+static inline void vec_f4_store_u8(uint8_t *p, vec_f4 a)
+{
+#ifdef VEC_SIMD_SSE
+    __m128i i = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_setzero_si128());
+    int32_t v = _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+
+    memcpy(p, &v, sizeof(v));
+#else
+    float x;
+    int j;
+
+    for (j = 0; j < 4; ++j) {
+        x = rintf(a.e[j]);
+        p[j] = x > 0.0f ? (x < 255.0f ? x : 255.0f) : 0.0f;
+    }
+#endif
+}
+
+/* Eight lane primitives */
+
+#ifdef VEC_SIMD_AVX
+static inline vec_f8 vec_f8_set1(float a)
+{
+    return _mm256_set1_ps(a);
+}
+
+static inline vec_f8 vec_f8_load(const float *p)
+{
+    return _mm256_loadu_ps(p);
+}
+
+static inline void vec_f8_store(float *p, vec_f8 a)
+{
+    _mm256_storeu_ps(p, a);
+}
+
+static inline vec_f8 vec_f8_add(vec_f8 a, vec_f8 b)
+{
+    return _mm256_add_ps(a, b);
+}
+
+static inline vec_f8 vec_f8_sub(vec_f8 a, vec_f8 b)
+{
+    return _mm256_sub_ps(a, b);
+}
+
+static inline vec_f8 vec_f8_mul(vec_f8 a, vec_f8 b)
+{
+    return _mm256_mul_ps(a, b);
+}
+
+static inline vec_f8 vec_f8_rsqrt(vec_f8 a)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    __m256 r = _mm256_rsqrt_ps(a);
+
+    return _mm256_mul_ps(_mm256_mul_ps(half, r),
+                         _mm256_sub_ps(three,
+                                       _mm256_mul_ps(_mm256_mul_ps(a, r), r)));
+}
+
+static inline vec_f8 vec_f8_sqrt(vec_f8 a)
+{
+    return _mm256_sqrt_ps(a);
+}
+#else
+/* Pairs of four lane vectors */
+
+static inline vec_f8 vec_f8_set1(float a)
+{
+    return (vec_f8) { vec_f4_set1(a), vec_f4_set1(a) };
+}
+
+static inline vec_f8 vec_f8_load(const float *p)
+{
+    return (vec_f8) { vec_f4_load(p), vec_f4_load(p + 4) };
+}
+
+static inline void vec_f8_store(float *p, vec_f8 a)
+{
+    vec_f4_store(p, a.lo);
+    vec_f4_store(p + 4, a.hi);
+}
+
+#define VEC_F8_OP(name)                                                     \
+static inline vec_f8 vec_f8_##name(vec_f8 a, vec_f8 b)                     \
+{                                                                           \
+    return (vec_f8) { vec_f4_##name(a.lo, b.lo), vec_f4_##name(a.hi, b.hi) }; \
+}
+
+VEC_F8_OP(add)
+VEC_F8_OP(sub)
+VEC_F8_OP(mul)
+
+#undef VEC_F8_OP
+
+static inline vec_f8 vec_f8_rsqrt(vec_f8 a)
+{
+    return (vec_f8) { vec_f4_rsqrt(a.lo), vec_f4_rsqrt(a.hi) };
+}
+
+static inline vec_f8 vec_f8_sqrt(vec_f8 a)
+{
+    return (vec_f8) { vec_f4_sqrt(a.lo), vec_f4_sqrt(a.hi) };
+}
+#endif
+
+/* Scalar reciprocal square root with the same accuracy as the packed one */
+static inline float vec_rsqrtf(float a)
+{
+#ifdef VEC_SIMD_SSE
+    float r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(a)));
+
+    return 0.5f * r * (3.0f - a * r * r);
+#else
+    return 1.0f / sqrtf(a);
+#endif
+}
+
+/* Padded vec3 */
+
+static inline struct vec4 vec4_from_vec3(struct vec3 a)
+{
+    return (struct vec4) {{{ a.x, a.y, a.z, 0.0f }}};
+}
+
+static inline struct vec3 vec4_to_vec3(struct vec4 a)
+{
+    return (struct vec3) { a.x, a.y, a.z };
+}
+
+static inline struct vec4 vec4_add(struct vec4 a, struct vec4 b)
+{
+    struct vec4 r;
+
+    vec_f4_store(r.e, vec_f4_add(vec_f4_load(a.e), vec_f4_load(b.e)));
+
+    return r;
+}
+
+static inline struct vec4 vec4_sub(struct vec4 a, struct vec4 b)
+{
+    struct vec4 r;
+
+    vec_f4_store(r.e, vec_f4_sub(vec_f4_load(a.e), vec_f4_load(b.e)));
+
+    return r;
+}
+
+static inline struct vec4 vec4_muls(struct vec4 a, float b)
+{
+    struct vec4 r;
+
+    vec_f4_store(r.e, vec_f4_mul(vec_f4_load(a.e), vec_f4_set1(b)));
+
+    return r;
+}
+
+/* The pad lane is ignored by the three component operations */
+static inline float vec4_dot3(struct vec4 a, struct vec4 b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline float vec4_norm3(struct vec4 a)
+{
+    return sqrtf(vec4_dot3(a, a));
+}
+
+static inline struct vec4 vec4_normalize3(struct vec4 a)
+{
+    return vec4_muls(a, vec_rsqrtf(vec4_dot3(a, a)));
+}
+
+/* Four and eight wide SoA vec3 */
+
+static inline struct vec3x4 vec3x4_load(const float *x, const float *y,
+                                        const float *z)
+{
+    return (struct vec3x4) {
+        vec_f4_load(x), vec_f4_load(y), vec_f4_load(z)
+    };
+}
+
+static inline void vec3x4_store(float *x, float *y, float *z,
+                                struct vec3x4 a)
+{
+    vec_f4_store(x, a.x);
+    vec_f4_store(y, a.y);
+    vec_f4_store(z, a.z);
+}
+
+static inline struct vec3x4 vec3x4_add(struct vec3x4 a, struct vec3x4 b)
+{
+    return (struct vec3x4) {
+        vec_f4_add(a.x, b.x), vec_f4_add(a.y, b.y), vec_f4_add(a.z, b.z)
+    };
+}
+
+static inline struct vec3x4 vec3x4_sub(struct vec3x4 a, struct vec3x4 b)
+{
+    return (struct vec3x4) {
+        vec_f4_sub(a.x, b.x), vec_f4_sub(a.y, b.y), vec_f4_sub(a.z, b.z)
+    };
+}
+
+static inline struct vec3x4 vec3x4_mul(struct vec3x4 a, vec_f4 b)
+{
+    return (struct vec3x4) {
+        vec_f4_mul(a.x, b), vec_f4_mul(a.y, b), vec_f4_mul(a.z, b)
+    };
+}
+
+static inline vec_f4 vec3x4_dot(struct vec3x4 a, struct vec3x4 b)
+{
+    return vec_f4_add(vec_f4_add(vec_f4_mul(a.x, b.x), vec_f4_mul(a.y, b.y)),
+                      vec_f4_mul(a.z, b.z));
+}
+
+static inline struct vec3x4 vec3x4_normalize(struct vec3x4 a)
+{
+    return vec3x4_mul(a, vec_f4_rsqrt(vec3x4_dot(a, a)));
+}
+
+static inline struct vec3x8 vec3x8_load(const float *x, const float *y,
+                                        const float *z)
+{
+    return (struct vec3x8) {
+        vec_f8_load(x), vec_f8_load(y), vec_f8_load(z)
+    };
+}
+
+static inline void vec3x8_store(float *x, float *y, float *z,
+                                struct vec3x8 a)
+{
+    vec_f8_store(x, a.x);
+    vec_f8_store(y, a.y);
+    vec_f8_store(z, a.z);
+}
+
+static inline struct vec3x8 vec3x8_add(struct vec3x8 a, struct vec3x8 b)
+{
+    return (struct vec3x8) {
+        vec_f8_add(a.x, b.x), vec_f8_add(a.y, b.y), vec_f8_add(a.z, b.z)
+    };
+}
+
+static inline struct vec3x8 vec3x8_sub(struct vec3x8 a, struct vec3x8 b)
+{
+    return (struct vec3x8) {
+        vec_f8_sub(a.x, b.x), vec_f8_sub(a.y, b.y), vec_f8_sub(a.z, b.z)
+    };
+}
+
+static inline struct vec3x8 vec3x8_mul(struct vec3x8 a, vec_f8 b)
+{
+    return (struct vec3x8) {
+        vec_f8_mul(a.x, b), vec_f8_mul(a.y, b), vec_f8_mul(a.z, b)
+    };
+}
+
+static inline vec_f8 vec3x8_dot(struct vec3x8 a, struct vec3x8 b)
+{
+    return vec_f8_add(vec_f8_add(vec_f8_mul(a.x, b.x), vec_f8_mul(a.y, b.y)),
+                      vec_f8_mul(a.z, b.z));
+}
+
+static inline struct vec3x8 vec3x8_normalize(struct vec3x8 a)
+{
+    return vec3x8_mul(a, vec_f8_rsqrt(vec3x8_dot(a, a)));
+}
+
+/*
+ * Array operations. The elementwise ones take any float span, e.g. a span of
+ * n vec3s as 3 * n floats. The others take SoA coordinate streams.
+ */
+
+static inline void vec_simd_add(float *dst, const float *a, const float *b,
+                                size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        vec_f8_store(dst + i, vec_f8_add(vec_f8_load(a + i),
+                                         vec_f8_load(b + i)));
+    for (; i < n; ++i)
+        dst[i] = a[i] + b[i];
+}
+
+static inline void vec_simd_scale(float *dst, const float *a, float s,
+                                  size_t n)
+{
+    const vec_f8 s8 = vec_f8_set1(s);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        vec_f8_store(dst + i, vec_f8_mul(vec_f8_load(a + i), s8));
+    for (; i < n; ++i)
+        dst[i] = a[i] * s;
+}
+
+static inline void vec3_soa_dot(float *dst, const float *ax, const float *ay,
+                                const float *az, const float *bx,
+                                const float *by, const float *bz, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        vec_f8_store(dst + i,
+                     vec3x8_dot(vec3x8_load(ax + i, ay + i, az + i),
+                                vec3x8_load(bx + i, by + i, bz + i)));
+    for (; i < n; ++i)
+        dst[i] = ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i];
+}
+
+static inline void vec3_soa_norm(float *dst, const float *x, const float *y,
+                                 const float *z, size_t n)
+{
+    struct vec3x8 v;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        v = vec3x8_load(x + i, y + i, z + i);
+        vec_f8_store(dst + i, vec_f8_sqrt(vec3x8_dot(v, v)));
+    }
+    for (; i < n; ++i)
+        dst[i] = sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+}
+
+/* The vectors have to be non-zero, dst may be the source */
+static inline void vec3_soa_normalize(float *dx, float *dy, float *dz,
+                                      const float *x, const float *y,
+                                      const float *z, size_t n)
+{
+    float r;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        vec3x8_store(dx + i, dy + i, dz + i,
+                     vec3x8_normalize(vec3x8_load(x + i, y + i, z + i)));
+    for (; i < n; ++i) {
+        r = vec_rsqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        dx[i] = x[i] * r;
+        dy[i] = y[i] * r;
+        dz[i] = z[i] * r;
+    }
+}
+
+#endif